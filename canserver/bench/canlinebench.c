@@ -0,0 +1,113 @@
+/*
+ * This file is part of the CANserver project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of parser of adapter lines: old `sscanf` parser vs `canline_hdr`/`canline_data`
+ * Usage: canlinebench [corpus] (default: canlines.txt) - file with lines of adapter output
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "canline.h"
+
+// amount of passes through corpus
+#define NPASSES     (20000)
+#define MAXLINES    (4096)
+
+typedef struct{
+    uint32_t timemark;
+    uint16_t ID;
+    uint8_t data[8];
+    uint8_t len;
+} frame;
+
+static double dtime(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+// parser used before: one `sscanf` into static structure
+static frame *parse_sscanf(const char *str){
+    static frame m;
+    int l = sscanf(str, "%u #0x%hx 0x%hhx 0x%hhx 0x%hhx 0x%hhx 0x%hhx 0x%hhx 0x%hhx 0x%hhx", &m.timemark, &m.ID,
+                   &m.data[0], &m.data[1], &m.data[2], &m.data[3], &m.data[4], &m.data[5], &m.data[6], &m.data[7]);
+    if(l < 2) return NULL;
+    m.len = l - 2;
+    return &m;
+}
+
+// the current parser
+static frame *parse_canline(const char *str, frame *m){
+    const char *s = canline_hdr(str, &m->timemark, &m->ID);
+    if(!s) return NULL;
+    m->len = canline_data(s, m->data);
+    return m;
+}
+
+// checksum of parsed frame (to compare parsers and don't let compiler throw them away)
+static uint32_t fsum(const frame *m){
+    if(!m) return 1;
+    uint32_t s = m->timemark * 31 + m->ID * 7 + m->len;
+    for(int i = 0; i < m->len; ++i) s = s * 131 + m->data[i];
+    return s;
+}
+
+int main(int argc, char **argv){
+    static char *lines[MAXLINES];
+    char buf[256];
+    int n = 0;
+    const char *name = (argc > 1) ? argv[1] : "canlines.txt";
+    FILE *f = fopen(name, "r");
+    if(!f){
+        perror(name);
+        return 1;
+    }
+    while(n < MAXLINES && fgets(buf, sizeof(buf), f)) lines[n++] = strdup(buf);
+    fclose(f);
+    if(!n){
+        fprintf(stderr, "%s is empty\n", name);
+        return 1;
+    }
+    // both parsers should give the same result
+    for(int i = 0; i < n; ++i){
+        frame m;
+        if(fsum(parse_sscanf(lines[i])) != fsum(parse_canline(lines[i], &m))){
+            fprintf(stderr, "Parsers differ on line %d: %s", i + 1, lines[i]);
+            return 1;
+        }
+    }
+    uint32_t sum = 0;
+    double t0 = dtime();
+    for(int p = 0; p < NPASSES; ++p) for(int i = 0; i < n; ++i) sum += fsum(parse_sscanf(lines[i]));
+    double told = dtime() - t0;
+    t0 = dtime();
+    for(int p = 0; p < NPASSES; ++p) for(int i = 0; i < n; ++i){
+        frame m;
+        sum -= fsum(parse_canline(lines[i], &m));
+    }
+    double tnew = dtime() - t0;
+    double nl = (double)n * NPASSES;
+    printf("%d lines x %d passes (checksum %u)\n", n, NPASSES, sum);
+    printf("sscanf:  %.3g lines/s\n", nl / told);
+    printf("canline: %.3g lines/s (x%.1f)\n", nl / tnew, told / tnew);
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * This file is part of the CANserver project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of interthread messages FIFO: ring buffer `message` vs linked list used before
+ * One producer thread sends CANmesg to one consumer (not more than INFLIGHT messages in queue)
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <usefull_macros.h>
+
+#include "threadlist.h"
+
+// amount of messages to send
+#define NMESG       (2000000)
+// max amount of messages in queue (ring buffer shouldn't overflow)
+#define INFLIGHT    (1000)
+
+// FIFO used before: list of allocated nodes
+typedef struct msglist_{
+    void *data;
+    size_t size;
+    struct msglist_ *next, *last;
+} msglist;
+
+typedef struct{
+    msglist *msg;
+    pthread_mutex_t mutex;
+} oldmessage;
+
+static int oldadd(oldmessage *m, const void *v, size_t size){
+    msglist *node = calloc(1, sizeof(msglist));
+    if(!node) return 1;
+    if(!(node->data = malloc(size))){
+        free(node);
+        return 1;
+    }
+    memcpy(node->data, v, size);
+    node->size = size;
+    pthread_mutex_lock(&m->mutex);
+    if(!m->msg){
+        m->msg = node;
+        node->last = node;
+    }else{
+        m->msg->last->next = node;
+        m->msg->last = node;
+    }
+    pthread_mutex_unlock(&m->mutex);
+    return 0;
+}
+
+static void *oldget(oldmessage *m){
+    pthread_mutex_lock(&m->mutex);
+    msglist *node = m->msg;
+    if(!node){
+        pthread_mutex_unlock(&m->mutex);
+        return NULL;
+    }
+    if(node->next) node->next->last = node->last;
+    m->msg = node->next;
+    pthread_mutex_unlock(&m->mutex);
+    void *ret = node->data;
+    free(node);
+    return ret;
+}
+
+static oldmessage oldq = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+static message ringq = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+static int usering = 0;
+static uint32_t consumed = 0;
+
+static void *producer(_U_ void *arg){
+    CANmesg m = {.ID = 0x58a, .len = 8};
+    for(uint32_t i = 0; i < NMESG; ++i){
+        while(i - __atomic_load_n(&consumed, __ATOMIC_ACQUIRE) >= INFLIGHT) sched_yield();
+        m.timemark = i;
+        int r = usering ? !mesgAddObj(&ringq, MESG_CAN, &m, sizeof(m)) : oldadd(&oldq, &m, sizeof(m));
+        if(r){
+            fprintf(stderr, "Can't add message %u\n", i);
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+// @return messages per second
+static double run(int ring){
+    pthread_t thr;
+    usering = ring;
+    __atomic_store_n(&consumed, 0, __ATOMIC_RELEASE);
+    double t0 = dtime();
+    if(pthread_create(&thr, NULL, producer, NULL)){
+        perror("pthread_create()");
+        exit(1);
+    }
+    for(uint32_t i = 0; i < NMESG;){
+        CANmesg m, *p;
+        if(ring){
+            if(!mesgGetBuf(&ringq, NULL, &m, sizeof(m))){ sched_yield(); continue; }
+            p = &m;
+        }else if(!(p = oldget(&oldq))){ sched_yield(); continue; }
+        if(p->timemark != i){
+            fprintf(stderr, "Wrong order: got %u instead of %u\n", p->timemark, i);
+            exit(1);
+        }
+        if(!ring) free(p);
+        __atomic_store_n(&consumed, ++i, __ATOMIC_RELEASE);
+    }
+    pthread_join(thr, NULL);
+    return NMESG / (dtime() - t0);
+}
+
+int main(){
+    double o = run(0), r = run(1);
+    printf("%d messages of %zd bytes\n", NMESG, sizeof(CANmesg));
+    printf("list: %.3g messages/s\n", o);
+    printf("ring: %.3g messages/s (x%.1f)\n", r, r / o);
+    return 0;
+}
@@ -16,14 +16,20 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/select.h>
 #include <usefull_macros.h>
 
 #include "aux.h"
+#include "binframe.h"
 #include "canbus.h"
+#include "canline.h"
+#include "socketcan.h"
 
 #ifndef BUFLEN
 #define BUFLEN 80
@@ -33,21 +39,57 @@
 #define WAIT_TMOUT 0.01
 #endif
 
+// max amount of lines waiting for echo
+#define TXDEPTH_MAX     (16)
+// timeout for echo of written line
+#define ECHO_TMOUT      (0.1)
+// size of RX ring buffer (power of 2)
+#define RXRING_SZ       (1024)
+// reader thread checks stop flag with this period (ms)
+#define RXTHREAD_TMOUT  (100)
+// max length of line from adapter
+#define LINEBUF_SZ      (256)
+
 /*
 This file should provide next functions:
   int canbus_open(const char *devname) - calls @the beginning, return 0 if all OK
+        (devname is serial device for CANBUS_TTY or interface name for CANBUS_SOCKETCAN)
   int canbus_setspeed(int speed) - set given speed (in Kbaud) @ CAN bus (return 0 if all OK)
   void canbus_close() - calls @the end
   int canbus_write(CANmesg *mesg) - write `data` with length `len` to ID `ID`, return 0 if all OK
   int canbus_read(CANmesg *mesg) - blocking read (broadcast if ID==0 or only from given ID) from can bus, return 0 if all OK
+
+Receiving is made by separate thread `rxthread`: it waits for data by epoll, parses it and
+puts CAN frames into lock-free ring buffer `rxring` (single producer - `rxthread`,
+single consumer - caller of `canbus_read`). So writing never waits for reading.
 */
 
+static canbus_backend backend = CANBUS_TTY;
 static TTY_descr *dev = NULL;  // shoul be global to restore if die
 static int serialspeed = 115200; // speed to open serial device
-static int disconnected = 1; // ==1 if disconnected
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int disconnected = 1; // ==1 if disconnected
+static int allowbinary = 0; // ==1 to try binary framing (new adapter firmware)
+static int binmode = 0; // ==1 if adapter works in binary framing mode
+static binframe_buf binbuf; // RX buffer of binary mode
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER; // writers' mutex
+// receive filters (changed only under `fltmutex`)
+static canfilter filters[CANFILTERS_MAX];
+static int nfilters = 0; // ==0 - receive all
+static pthread_mutex_t fltmutex = PTHREAD_MUTEX_INITIALIZER;
+// copy of filters for `canbus_accept`: ID<<16|mask, protected by seqlock `fltseq` (odd while changing)
+static uint32_t fltpacked[CANFILTERS_MAX];
+static int nfltpacked = 0;
+static uint32_t fltseq = 0;
+
+// RX ring buffer
+static CANmesg rxring[RXRING_SZ];
+static uint32_t rxhead = 0, rxtail = 0; // consumer and producer indexes
+static int rxevfd = -1; // eventfd to wake up consumer
+static pthread_t rxthread;
+static int rxrunning = 0, rxstop = 0;
 
 static char *read_string();
+static int canbus_accept(uint16_t ID);
 
 /**
  * @brief read_ttyX- read data from TTY with 10ms timeout WITH disconnect detection
@@ -87,44 +129,424 @@ static int read_ttyX(TTY_descr *d){
     return (size_t)L;
 }
 
+// put message into RX ring (only from `rxthread`), @return 1 if ring is full
+static int rxring_push(const CANmesg *m){
+    uint32_t tail = __atomic_load_n(&rxtail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&rxhead, __ATOMIC_ACQUIRE);
+    if(tail - head >= RXRING_SZ) return 1;
+    rxring[tail & (RXRING_SZ - 1)] = *m;
+    __atomic_store_n(&rxtail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// get message from RX ring (only from `canbus_read`), @return 1 if ring is empty
+static int rxring_pop(CANmesg *m){
+    uint32_t head = __atomic_load_n(&rxhead, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&rxtail, __ATOMIC_ACQUIRE);
+    if(head == tail) return 1;
+    *m = rxring[head & (RXRING_SZ - 1)];
+    __atomic_store_n(&rxhead, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Pipelined transmission in ASCII mode: adapter echoes each command line, so
+ * written lines are stored in `pending` FIFO until their echo arrives. Up to
+ * `txdepth` lines can be in flight; echoes are removed by `rxthread`.
+ */
+typedef struct{
+    char line[BUFLEN];  // line sent (without trailing '\n')
+    double t;           // time of sending
+} pendingTX;
+static pendingTX pending[TXDEPTH_MAX];
+static int pendhead = 0, pendnum = 0; // first pending line and amount of lines in flight
+static int txdepth = 4; // max amount of lines in flight
+static pthread_mutex_t pendmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pendcond = PTHREAD_COND_INITIALIZER; // signaled when `pendnum` decreased
+
+// remove oldest line from pending FIFO (`pendmutex` should be locked)
+static void pending_pop(){
+    if(!pendnum) return;
+    pendhead = (pendhead + 1) % TXDEPTH_MAX;
+    --pendnum;
+    pthread_cond_broadcast(&pendcond);
+}
+
+// drop lines which echo wasn't received in time (`pendmutex` should be locked)
+static void pending_expire(){
+    double t = dtime();
+    while(pendnum && t - pending[pendhead].t > ECHO_TMOUT){
+        WARNX("No echo for '%s'", pending[pendhead].line);
+        LOGWARN("No echo from adapter for '%s'", pending[pendhead].line);
+        pending_pop();
+    }
+}
+
+// @return 1 if there's nothing except spaces or '\r' till the end of line `s`
+static int lineend(const char *s){
+    while(*s == ' ' || *s == '\t' || *s == '\r') ++s;
+    return !*s;
+}
 
-// thread-safe writing, add trailing '\n'
-static int ttyWR(const char *buff, int len){
+/**
+ * @brief process_line - sort line from adapter: echo of pending line or received CAN frame
+ * @param s - line
+ * @return 1 if it was CAN frame (put into `rxring`), 0 otherwise
+ */
+static int process_line(const char *s){
+    CANmesg m;
+    const char *data = canline_hdr(s, &m.timemark, &m.ID);
+    if(data){
+        if(!canbus_accept(m.ID)) return 0; // drop before data parsing
+        m.len = canline_data(data, m.data);
+        if(rxring_push(&m)) WARNX("RX ring overflow");
+        return 1;
+    }
+    pthread_mutex_lock(&pendmutex);
+    for(int i = 0; i < pendnum; ++i){ // search echo (some of previous could be lost)
+        pendingTX *p = &pending[(pendhead + i) % TXDEPTH_MAX];
+        size_t l = strlen(p->line); // echo should be the whole line, not only its beginning
+        if(strncmp(s, p->line, l) || !lineend(s + l)) continue;
+        while(i--){
+            WARNX("Lost echo for '%s'", pending[pendhead].line);
+            pending_pop();
+        }
+        pending_pop();
+        pthread_mutex_unlock(&pendmutex);
+        return 0;
+    }
+    pthread_mutex_unlock(&pendmutex);
+    DBG("Unknown line from adapter: %s", s);
+    return 0;
+}
+
+// wait on `pendcond` while amount of lines in flight >= `maxnum` (`pendmutex` should be locked)
+static void pending_wait(int maxnum){
+    while(pendnum >= maxnum && !disconnected){
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += (long)(ECHO_TMOUT * 1e9 / 2.);
+        if(ts.tv_nsec >= 1000000000L){ ts.tv_nsec -= 1000000000L; ++ts.tv_sec; }
+        pthread_cond_timedwait(&pendcond, &pendmutex, &ts);
+        pending_expire();
+    }
+}
+
+/**
+ * @brief ttyWR - thread-safe writing of one or several lines
+ * @param buff   - lines to write, each ends with '\n'
+ * @param len    - total length
+ * @param nlines - amount of lines in `buff` (not more than `txdepth`)
+ * @param sync   - ==1 to wait for echo of all lines in flight (including these)
+ * @return 0 if all OK
+ */
+static int ttyWR(const char *buff, int len, int nlines, int sync){
     if(disconnected) return 1;
+    if(len < 2 || nlines < 1 || nlines > txdepth) return 1;
     pthread_mutex_lock(&mutex);
-    //canbus_clear();
-    read_string(); // clear RX buffer
-    int w = write_tty(dev->comfd, buff, (size_t)len);
-    if(!w) w = write_tty(dev->comfd, "\n", 1);
-    int errctr = 0;
-    while(1){
-        char *s = read_string(); // clear echo & check
-        if(disconnected){
-            w = 1; break;
+    pthread_mutex_lock(&pendmutex);
+    pending_wait(sync ? 1 : txdepth - nlines + 1);
+    // add lines to pending list before writing: echo can come at once
+    const char *l = buff, *e = buff + len;
+    for(int i = 0; i < nlines && l < e; ++i){
+        const char *nl = memchr(l, '\n', e - l);
+        if(!nl) nl = e;
+        int ll = nl - l;
+        if(ll > BUFLEN - 1) ll = BUFLEN - 1;
+        pendingTX *p = &pending[(pendhead + pendnum) % TXDEPTH_MAX];
+        memcpy(p->line, l, ll);
+        p->line[ll] = 0;
+        p->t = dtime();
+        ++pendnum;
+        l = nl + 1;
+    }
+    pthread_mutex_unlock(&pendmutex);
+    int w = disconnected ? 1 : write_tty(dev->comfd, buff, (size_t)len);
+    pthread_mutex_lock(&pendmutex);
+    if(w){
+        pendnum = (pendnum > nlines) ? pendnum - nlines : 0; // remove just added lines
+    }else if(sync) pending_wait(1);
+    if(disconnected){
+        w = 1;
+        pendnum = 0;
+    }
+    pthread_mutex_unlock(&pendmutex);
+    pthread_mutex_unlock(&mutex);
+    return w;
+}
+
+/**
+ * @brief setTXdepth - set max amount of frames in flight (ASCII mode)
+ * @param depth - 1..TXDEPTH_MAX
+ */
+void setTXdepth(int depth){
+    if(depth < 1) depth = 1;
+    else if(depth > TXDEPTH_MAX) depth = TXDEPTH_MAX;
+    txdepth = depth;
+}
+
+/**
+ * @brief binWR - thread-safe writing of one or several binary frames
+ * @param frames - frames to write
+ * @param len    - total length
+ * @return 0 if all OK
+ */
+static int binWR(const uint8_t *frames, int len){
+    if(disconnected || len < 1) return 1;
+    pthread_mutex_lock(&mutex);
+    int w = write_tty(dev->comfd, (const char*)frames, len);
+    pthread_mutex_unlock(&mutex);
+    return w;
+}
+
+// parse all full frames in `binbuf`, @return amount of CAN frames
+static int process_binbuf(){
+    uint8_t payload[BIN_MAXPAYLOAD + 1], type;
+    int l, N = 0;
+    CANmesg m;
+    while((l = binframe_get(&binbuf, &type, payload)) > -1){
+        if(type == BINF_CAN){
+            if(binframe_parsecan(payload, l, &m.timemark, &m.ID, m.data, &m.len)){
+                WARNX("Got wrong binary CAN frame");
+                continue;
+            }
+            if(!canbus_accept(m.ID)) continue;
+            if(rxring_push(&m)) WARNX("RX ring overflow");
+            else ++N;
+        }else if(type == BINF_CMD){
+            payload[l] = 0;
+            DBG("Adapter answer: %s", (char*)payload);
         }
-        if(!s || strncmp(s, buff, strlen(buff)) != 0){
-            if(++errctr > 3){
-                WARNX("wrong answer! Got '%s' instead of '%s'", s, buff);
-                w = 1;
+    }
+    return N;
+}
+
+/**
+ * @brief negotiate_binary - try to switch adapter into binary framing mode
+ * @return 1 if adapter works in binary mode, 0 if only ASCII protocol supported
+ * Should be called before `rxthread` started
+ */
+static int negotiate_binary(){
+    binmode = 0;
+    binbuf.len = 0;
+    if(!allowbinary) return 0;
+    canbus_clear();
+    if(write_tty(dev->comfd, BINMODE_CMD "\n", sizeof(BINMODE_CMD))) return 0;
+    double t0 = dtime();
+    while(dtime() - t0 < BINMODE_TMOUT && !disconnected){
+        char *s = read_string(); // skip echo and other garbage
+        if(s && strncmp(s, BINMODE_ANS, sizeof(BINMODE_ANS) - 1) == 0){
+            binmode = 1;
+            break;
+        }
+    }
+    if(binmode){
+        LOGMSG("CAN adapter works in binary mode");
+    }else{
+        WARNX("CAN adapter doesn't support binary mode, use ASCII");
+        LOGWARN("CAN adapter doesn't support binary mode, use ASCII");
+        canbus_clear();
+    }
+    return binmode;
+}
+
+/**
+ * @brief rxthread_ - receiving thread: read all incoming data and put CAN frames into `rxring`
+ * @param arg - unused
+ * @return unused
+ */
+static void *rxthread_(_U_ void *arg){
+    int fd = (backend == CANBUS_SOCKETCAN) ? sockcan_fd() : dev->comfd;
+    int ep = epoll_create1(0);
+    if(ep < 0){
+        WARN("epoll_create1()");
+        disconnected = 1;
+        return NULL;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+    if(epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev)){
+        WARN("epoll_ctl()");
+        close(ep);
+        disconnected = 1;
+        return NULL;
+    }
+    char buf[LINEBUF_SZ], line[LINEBUF_SZ];
+    size_t linelen = 0;
+    while(!__atomic_load_n(&rxstop, __ATOMIC_ACQUIRE)){
+        int n = epoll_wait(ep, &ev, 1, RXTHREAD_TMOUT);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            WARN("epoll_wait()");
+            disconnected = 1;
+            break;
+        }
+        int N = 0; // amount of new frames
+        if(n > 0){
+            if(ev.events & (EPOLLERR | EPOLLHUP)){
+                LOGERR("CAN device disconnected");
+                disconnected = 1;
                 break;
             }
-        }else break;
+            if(backend == CANBUS_SOCKETCAN){
+                CANmesg m;
+                int r;
+                while(0 == (r = sockcan_read(&m, 0.))){
+                    if(rxring_push(&m)) WARNX("RX ring overflow");
+                    else ++N;
+                }
+                if(r < 0){
+                    LOGERR("CAN interface is down");
+                    disconnected = 1;
+                }
+            }else{
+                ssize_t l = read(fd, buf, sizeof(buf));
+                if(l < 1){
+                    if(l < 0 && errno == EINTR) continue;
+                    LOGERR("Tty disconnected");
+                    WARNX("TTY disconnected");
+                    disconnected = 1;
+                }else if(binmode){
+                    binframe_add(&binbuf, buf, l);
+                    N = process_binbuf();
+                }else for(ssize_t i = 0; i < l; ++i){
+                    if(buf[i] == '\n'){
+                        line[linelen] = 0;
+                        if(linelen) N += process_line(line);
+                        linelen = 0;
+                    }else if(linelen < LINEBUF_SZ - 1) line[linelen++] = buf[i];
+                    else{
+                        WARNX("Too long line from adapter");
+                        linelen = 0;
+                    }
+                }
+            }
+        }
+        if(N){
+            uint64_t one = 1;
+            if(sizeof(one) != write(rxevfd, &one, sizeof(one))) WARN("write(eventfd)");
+        }
+        if(!binmode){
+            pthread_mutex_lock(&pendmutex);
+            if(disconnected) pendnum = 0;
+            pending_expire();
+            pthread_mutex_unlock(&pendmutex);
+        }
+        if(disconnected) break;
     }
-    pthread_mutex_unlock(&mutex);
-    return w;
+    if(disconnected) pthread_cond_broadcast(&pendcond);
+    close(ep);
+    return NULL;
+}
+
+// stop receiving thread
+static void stop_rxthread(){
+    if(!rxrunning) return;
+    __atomic_store_n(&rxstop, 1, __ATOMIC_RELEASE);
+    pthread_join(rxthread, NULL);
+    rxrunning = 0;
+}
+
+// run receiving thread, @return 0 if all OK
+static int start_rxthread(){
+    if(rxevfd < 0 && (rxevfd = eventfd(0, EFD_NONBLOCK)) < 0){
+        WARN("eventfd()");
+        return 1;
+    }
+    rxstop = 0;
+    if(pthread_create(&rxthread, NULL, rxthread_, NULL)){
+        WARN("pthread_create()");
+        return 1;
+    }
+    rxrunning = 1;
+    return 0;
 }
 
 void canbus_close(){
+    stop_rxthread();
     if(dev) close_tty(&dev);
+    sockcan_close();
     disconnected = 1;
+    binmode = 0;
+    pthread_mutex_lock(&pendmutex);
+    pendnum = 0;
+    pthread_cond_broadcast(&pendcond);
+    pthread_mutex_unlock(&pendmutex);
+}
+
+/**
+ * @brief canbus_setbackend - select CAN bus backend
+ * @param b - backend
+ * Should be called before `canbus_open`
+ */
+void canbus_setbackend(canbus_backend b){
+    backend = b;
 }
 
 void setserialspeed(int speed){
     serialspeed = speed;
 }
 
+/**
+ * @brief canbus_setfilters - set receive filters
+ * @param f - array of ID/mask pairs: message passes if (ID & mask) == (f.ID & mask)
+ * @param n - its length (0 - receive all)
+ * @return 0 if all OK
+ */
+int canbus_setfilters(const canfilter *f, int n){
+    if(n < 0 || (n && !f)) return 1;
+    if(n > CANFILTERS_MAX){
+        WARNX("Too many CAN filters (%d), receive all", n);
+        n = 0;
+    }
+    pthread_mutex_lock(&fltmutex);
+    if(n) memcpy(filters, f, n * sizeof(canfilter));
+    nfilters = n;
+    uint32_t seq = fltseq;
+    __atomic_store_n(&fltseq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for(int i = 0; i < n; ++i)
+        __atomic_store_n(&fltpacked[i], ((uint32_t)f[i].ID << 16) | f[i].mask, __ATOMIC_RELAXED);
+    __atomic_store_n(&nfltpacked, n, __ATOMIC_RELAXED);
+    __atomic_store_n(&fltseq, seq + 2, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&fltmutex);
+    if(backend == CANBUS_SOCKETCAN && !disconnected) return sockcan_setfilters(f, n);
+    return 0;
+}
+
+// @return 1 if message with given ID passes filters (lock-free, called for each frame by `rxthread`)
+static int canbus_accept(uint16_t ID){
+    while(1){
+        uint32_t seq = __atomic_load_n(&fltseq, __ATOMIC_ACQUIRE);
+        if(seq & 1) continue; // filters are changing now
+        int n = __atomic_load_n(&nfltpacked, __ATOMIC_RELAXED), ret = !n;
+        for(int i = 0; i < n && !ret; ++i){
+            uint32_t f = __atomic_load_n(&fltpacked[i], __ATOMIC_RELAXED);
+            uint16_t mask = f & 0xffff;
+            if((ID & mask) == ((f >> 16) & mask)) ret = 1;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&fltseq, __ATOMIC_RELAXED) == seq) return ret;
+    }
+}
+
+/**
+ * @brief setbinarymode - allow or deny binary framing of adapter link
+ * @param allow - ==1 to try binary framing (adapter firmware should support it: old firmware
+ *      takes "binmode" for bitrate command "b")
+ * Should be called before `canbus_open`
+ */
+void setbinarymode(int allow){
+    allowbinary = allow;
+}
+
+/**
+ * @brief canbus_clear - clear RX buffer of serial device
+ * Do nothing when receiving thread works: all data will be read by it
+ */
 void canbus_clear(){
+    if(backend == CANBUS_SOCKETCAN || rxrunning) return;
     while(read_ttyX(dev) > 0);
+    binbuf.len = 0;
 }
 
 int canbus_open(const char *devname){
@@ -132,23 +554,38 @@ int canbus_open(const char *devname){
         WARNX("canbus_open(): need device name");
         return 1;
     }
-    disconnected = 1;
-    if(dev) close_tty(&dev);
-    dev = new_tty((char*)devname, serialspeed, BUFLEN);
-    if(dev){
-        if(!tty_open(dev, 1)) // blocking open
-            close_tty(&dev);
+    canbus_close();
+    if(backend == CANBUS_SOCKETCAN){
+        if(sockcan_open(devname)) return 1;
+        pthread_mutex_lock(&fltmutex);
+        sockcan_setfilters(filters, nfilters); // filtering by kernel
+        pthread_mutex_unlock(&fltmutex);
+    }else{
+        dev = new_tty((char*)devname, serialspeed, BUFLEN);
+        if(dev){
+            if(!tty_open(dev, 1)) // blocking open
+                close_tty(&dev);
+        }
+        if(!dev){
+            return 1;
+        }
     }
-    if(!dev){
+    disconnected = 0;
+    if(backend == CANBUS_TTY) negotiate_binary();
+    if(start_rxthread()){
+        canbus_close();
         return 1;
     }
-    disconnected = 0;
     return 0;
 }
 
 int canbus_setspeed(int speed){
     if(disconnected) return 1;
     if(speed == 0) return 0; // default - not change
+    if(backend == CANBUS_SOCKETCAN){ // bitrate can be set only by `ip link set IF type can bitrate X`
+        LOGWARN("Can't change bitrate of SocketCAN interface");
+        return 0;
+    }
     char buff[BUFLEN];
     if(speed < 10 || speed > 3000){
         WARNX("Wrong CAN bus speed value: %d", speed);
@@ -156,35 +593,95 @@ int canbus_setspeed(int speed){
     }
     int len = snprintf(buff, BUFLEN, "b %d", speed);
     if(len < 1) return 2;
-    int r = ttyWR(buff, len);
-    canbus_clear();
-    return r;
+    if(binmode){
+        uint8_t frame[BIN_FRAMESZ];
+        len = binframe_make(BINF_CMD, (uint8_t*)buff, len, frame);
+        return len ? binWR(frame, len) : 2;
+    }
+    buff[len++] = '\n';
+    return ttyWR(buff, len, 1, 1);
 }
 
 /**
- * @brief canbus_write - write message to CAN bus
- * @param mesg - raw message
- * @return 0 if all OK
+ * @brief mkline - make ASCII command to send CAN message
+ * @param mesg - message
+ * @param buf (o) - buffer for line (with trailing '\n')
+ * @param bufsz - its size
+ * @return line length or 0 if error
  */
-int canbus_write(CANmesg *mesg){
-    if(disconnected) return 1;
-    char buf[BUFLEN];
-    if(!mesg || mesg->len > 8) return 1;
-    int rem = BUFLEN, len = 0;
+static int mkline(const CANmesg *mesg, char *buf, int bufsz){
+    int rem = bufsz, len = 0;
     int l = snprintf(buf, rem, "s %d", mesg->ID);
     rem -= l; len += l;
     for(uint8_t i = 0; i < mesg->len; ++i){
+        if(rem < 1) return 0;
         l = snprintf(&buf[len], rem, " %d", mesg->data[i]);
         rem -= l; len += l;
-        if(rem < 0) return 2;
     }
-    canbus_clear();
-    return ttyWR(buf, len);
+    if(rem < 2) return 0;
+    buf[len++] = '\n';
+    return len;
+}
+
+/**
+ * @brief canbus_write_batch - write several messages to CAN bus by minimal amount of syscalls
+ * @param mesg - array of raw messages
+ * @param n    - its length
+ * @return 0 if all OK
+ */
+int canbus_write_batch(CANmesg *mesg, int n){
+    if(disconnected) return 1;
+    if(!mesg || n < 1) return 1;
+    for(int i = 0; i < n; ++i) if(mesg[i].len > 8) return 1;
+    if(backend == CANBUS_SOCKETCAN){
+        int r = 0;
+        pthread_mutex_lock(&mutex);
+        // full transmit queue is waited by `sockcan_write`, so failed frame is really lost
+        for(int i = 0; i < n && r > -1; ++i) r |= sockcan_write(&mesg[i]);
+        pthread_mutex_unlock(&mutex);
+        if(r < 0) disconnected = 1;
+        return r ? 1 : 0;
+    }
+    if(binmode){
+        uint8_t frames[BIN_FRAMESZ * TXBATCH_MAX];
+        int len = 0, r = 0;
+        for(int i = 0; i < n; ++i){
+            len += binframe_mkcan(mesg[i].ID, mesg[i].data, mesg[i].len, &frames[len]);
+            if(i == n - 1 || (i + 1) % TXBATCH_MAX == 0){
+                r |= binWR(frames, len);
+                len = 0;
+            }
+        }
+        return r;
+    }
+    // ASCII: not more than `txdepth` lines by one write
+    char lines[BUFLEN * TXDEPTH_MAX];
+    int len = 0, nlines = 0, r = 0;
+    for(int i = 0; i < n; ++i){
+        int l = mkline(&mesg[i], &lines[len], BUFLEN);
+        if(!l) return 2;
+        len += l;
+        if(++nlines == txdepth || i == n - 1){
+            r |= ttyWR(lines, len, nlines, 0);
+            len = 0; nlines = 0;
+        }
+    }
+    return r;
+}
+
+/**
+ * @brief canbus_write - write message to CAN bus
+ * @param mesg - raw message
+ * @return 0 if all OK
+ */
+int canbus_write(CANmesg *mesg){
+    return canbus_write_batch(mesg, 1);
 }
 
 /**
  * read strings from terminal (ending with '\n') with timeout
  * @return NULL if nothing was read or pointer to static buffer
+ * (only for use when `rxthread` isn't running)
  */
 static char *read_string(){
     if(disconnected) return NULL;
@@ -241,43 +738,37 @@ static char *read_string(){
 
 /**
  * @brief parseCANmesg - message parser
- * @param str - string from terminal: time #ID [data]
- * @return NULL if error or pointer to static structure
- * Not thread safe!!!
+ * @param str - string from terminal: time #0xID [0xdata]
+ * @param m (o) - parsed message
+ * @return 0 if all OK
+ * Reentrant: all data stored only in `m`
  */
-CANmesg *parseCANmesg(const char *str){
-    static CANmesg m;
-    int l = sscanf(str, "%d #0x%hx 0x%hhx 0x%hhx 0x%hhx 0x%hhx 0x%hhx 0x%hhx 0x%hhx 0x%hhx", &m.timemark, &m.ID,
-                   &m.data[0], &m.data[1], &m.data[2], &m.data[3], &m.data[4], &m.data[5], &m.data[6], &m.data[7]);
-    if(l < 2) return NULL;
-    m.len = l - 2;
-    return &m;
+int parseCANmesg(const char *str, CANmesg *m){
+    if(!str || !m) return 1;
+    const char *s = canline_hdr(str, &m->timemark, &m->ID);
+    if(!s) return 1;
+    m->len = canline_data(s, m->data);
+    return 0;
 }
 
 /**
  * @brief canbus_read - read any message from CAN bus
  * @param mesg - pointer to message
  * @return 0 if all OK
+ * Waits for message not more than T_POLLING_TMOUT; only one thread can read!
  */
 int canbus_read(CANmesg *mesg){
     if(!mesg) return 1;
-    if(disconnected) return 1;
-    pthread_mutex_lock(&mutex);
-    char *ans;
-    CANmesg *m;
-    double t0 = dtime();
-    while(dtime() - t0 < T_POLLING_TMOUT){ // read answer
-        if((ans = read_string())){ // parse new data
-            if((m = parseCANmesg(ans))){
-                memcpy(mesg, m, sizeof(CANmesg));
-                pthread_mutex_unlock(&mutex);
-                return 0;
-            }
+    if(!rxring_pop(mesg)) return 0;
+    if(disconnected || rxevfd < 0) return 1;
+    struct pollfd pfd = {.fd = rxevfd, .events = POLLIN};
+    if(poll(&pfd, 1, (int)(T_POLLING_TMOUT * 1000.)) > 0){
+        uint64_t cnt;
+        if(sizeof(cnt) != read(rxevfd, &cnt, sizeof(cnt))){
+            DBG("read(eventfd) failed");
         }
-        if(disconnected) break;
     }
-    pthread_mutex_unlock(&mutex);
-    return 1;
+    return rxring_pop(mesg);
 }
 
 int canbus_disconnected(){
@@ -25,6 +25,9 @@
 #define T_POLLING_TMOUT (0.01)
 #endif
 
+// max amount of messages for `canbus_write_batch` to send by one write
+#define TXBATCH_MAX     (32)
+
 typedef struct{
     uint32_t timemark;  // time since MCU run (ms)
     uint16_t ID;        // 11-bit identifier
@@ -32,18 +35,38 @@ typedef struct{
     uint8_t len;        // data length
 } CANmesg;
 
+// max amount of receive filters
+#define CANFILTERS_MAX  (32)
+
+// receive filter: message passes if (ID & mask) == (filter.ID & filter.mask)
+typedef struct{
+    uint16_t ID;
+    uint16_t mask;
+} canfilter;
+
+// CAN bus backends
+typedef enum{
+    CANBUS_TTY,         // USB-CAN adapter on serial device
+    CANBUS_SOCKETCAN    // Linux SocketCAN interface (can0, vcan0 etc)
+} canbus_backend;
+
 // main (necessary) functions of canbus.c:
 void canbus_close();
 int canbus_open(const char *devname);
 int canbus_write(CANmesg *mesg);
+int canbus_write_batch(CANmesg *mesg, int n);
 int canbus_read(CANmesg *mesg);
+int canbus_setfilters(const canfilter *f, int n);
 int canbus_setspeed(int speed);
 void canbus_clear();
 
 // auxiliary (not necessary) functions
 void setserialspeed(int speed);
+void setbinarymode(int allow);
+void canbus_setbackend(canbus_backend b);
+void setTXdepth(int depth);
 void showM(CANmesg *m);
-CANmesg *parseCANmesg(const char *str);
+int parseCANmesg(const char *str, CANmesg *m);
 int canbus_disconnected();
 
 #endif // CANBUS_H__
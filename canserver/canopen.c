@@ -127,15 +127,15 @@ CANmesg *mkMesg(SDO *sdo, CANmesg *mesg){
  * @return sdo or NULL depending on result
  */
 SDO *parseSDO(const CANmesg *mesg, SDO *sdo){
-    if(mesg->len != 8){
-        WARNX("Wrong SDO data length");
-        return NULL;
-    }
     uint16_t cobid = mesg->ID & COBID_MASK;
     if(cobid != TSDO_COBID){
         DBG("cobid=0x%X, not a TSDO!", cobid);
         return NULL; // not a transmit SDO
     }
+    if(mesg->len != 8){
+        WARNX("Wrong SDO data length");
+        return NULL;
+    }
     sdo->NID = mesg->ID & NODEID_MASK;
     uint8_t spec = mesg->data[0];
     sdo->ccs = GET_CCS(spec);
@@ -359,6 +359,90 @@ CANmesg *SDO_write(const SDO_dic_entry *e, uint8_t NID, int64_t data, CANmesg *c
     return cm;
 }
 
+/**
+ * @brief SDO_abort - form CANmesg to abort SDO transfer
+ * @param NID    - target node ID
+ * @param idx    - SDO index
+ * @param subidx - SDO subindex
+ * @param code   - abort code
+ * @param cm (o) - pointer to CANmesg which to modify
+ * @return `cm` or NULL if failed
+ */
+CANmesg *SDO_abort(uint8_t NID, uint16_t idx, uint8_t subidx, uint32_t code, CANmesg *cm){
+    if(!cm) return NULL;
+    SDO sdo = {
+        .NID = NID,
+        .ccs = CCS_ABORT_TRANSFER,
+        .index = idx,
+        .subindex = subidx
+    };
+    mkMesg(&sdo, cm);
+    for(int i = 0; i < 4; ++i) cm->data[4+i] = (code >> (8*i)) & 0xff;
+    return cm;
+}
+
+/**
+ * @brief SDO_abortmsg - explanation of abort code
+ * @param code - abort code
+ * @return text or NULL if code is unknown
+ */
+const char *SDO_abortmsg(uint32_t code){
+    const abortcodes *ac = abortcode_search(code);
+    return ac ? ac->errmsg : NULL;
+}
+
+/**
+ * @brief parseEMCY - decode emergency message
+ * @param mesg     - message from CAN bus
+ * @param emcy (o) - emergency
+ * @return `emcy` or NULL if it isn't EMCY
+ */
+EMCY *parseEMCY(const CANmesg *mesg, EMCY *emcy){
+    // ID 0x80 without node ID is SYNC
+    if((mesg->ID & COBID_MASK) != EMERG_COBID || !(mesg->ID & NODEID_MASK) || mesg->len < 3) return NULL;
+    emcy->NID = mesg->ID & NODEID_MASK;
+    emcy->code = (uint16_t)mesg->data[0] | ((uint16_t)mesg->data[1] << 8);
+    emcy->errreg = mesg->data[2];
+    for(int i = 0; i < 5; ++i) emcy->data[i] = (i + 3 < mesg->len) ? mesg->data[i + 3] : 0;
+    return emcy;
+}
+
+/**
+ * @brief EMCY_class - class of emergency error code (by its high byte)
+ * @param code - error code
+ * @return text
+ */
+const char *EMCY_class(uint16_t code){
+    switch(code >> 8){
+        case 0x00:
+            return "Error reset or no error";
+        case 0x10:
+            return "Generic error";
+        case 0x20: case 0x21: case 0x22: case 0x23:
+            return "Current";
+        case 0x30: case 0x31: case 0x32: case 0x33:
+            return "Voltage";
+        case 0x40: case 0x41: case 0x42:
+            return "Temperature";
+        case 0x50:
+            return "Device hardware";
+        case 0x60: case 0x61: case 0x62: case 0x63:
+            return "Device software";
+        case 0x70:
+            return "Additional modules";
+        case 0x80: case 0x81: case 0x82:
+            return "Monitoring";
+        case 0x90:
+            return "External error";
+        case 0xF0:
+            return "Additional functions";
+        case 0xFF:
+            return "Device specific";
+        default:
+            return "Unknown";
+    }
+}
+
 #if 0
 // write SDO data, return 0 if all OK
 int SDO_writeArr(const SDO_dic_entry *e, uint8_t NID, const uint8_t *data){
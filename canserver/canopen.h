@@ -28,6 +28,7 @@
 
 // COB-ID base:
 #define NMT_COBID           0
+#define SYNC_COBID          0x80
 #define EMERG_COBID         0x80
 #define TIMESTAMP_COBID     0x100
 #define TPDO1_COBID         0x180
@@ -45,6 +46,19 @@
 #define COBID_MASK          0x780
 // mask to select node ID from ID
 #define NODEID_MASK         0x7F
+// NMT command "start remote node" (go to operational state)
+#define NMT_START           0x01
+// NMT states of node in heartbeat messages
+#define NMT_BOOTUP          0x00
+#define NMT_STOPPED         0x04
+#define NMT_OPERATIONAL     0x05
+#define NMT_PREOPERATIONAL  0x7F
+// PDO COB-ID with this bit is invalid (PDO disabled)
+#define PDO_COBID_INVALID   (1U<<31)
+// PDO transmission type: asynchronous, event-driven
+#define PDO_TT_EVENT        0xFF
+// PDO transmission type: synchronous (RPDO data is actuated by next SYNC)
+#define PDO_TT_SYNC         0x01
 
 // SDO client command specifier field
 typedef enum{
@@ -67,6 +81,20 @@ typedef enum{
 // SDO e & s fields:
 #define SDO_E       (1<<1)
 #define SDO_S       (1<<0)
+// segment fields: toggle bit, no more segments bit and amount of data bytes
+#define SDO_T       (1<<4)
+#define SDO_C       (1<<0)
+#define SDO_SEG_N(n)        ((7-(n))<<1)
+#define SDO_SEG_datalen(f)  (7-(((f)>>1)&7))
+
+// abort codes of transfers aborted by client
+#define SDO_ABORT_TOGGLE    (0x05030000)
+#define SDO_ABORT_TIMEOUT   (0x05040000)
+#define SDO_ABORT_CCS       (0x05040001)
+#define SDO_ABORT_NOMEM     (0x05040005)
+
+// max data size of segmented transfer
+#define SDO_SEGDATA_MAX     (256)
 
 typedef struct{
     uint8_t NID;        // node ID in CANopen
@@ -82,6 +110,23 @@ typedef struct{
     const char *errmsg;
 } abortcodes;
 
+// data of segmented SDO upload
+typedef struct{
+    uint8_t NID;        // node ID
+    uint16_t index;     // SDO index
+    uint8_t subindex;   // SDO subindex
+    uint16_t len;       // data length
+    uint8_t data[SDO_SEGDATA_MAX];
+} SDOdata;
+
+// emergency message
+typedef struct{
+    uint8_t NID;        // node ID
+    uint16_t code;      // emergency error code (0 - error reset or no error)
+    uint8_t errreg;     // error register (object 0x1001)
+    uint8_t data[5];    // manufacturer specific error field
+} EMCY;
+
 CANmesg *mkMesg(SDO *sdo, CANmesg *mesg);
 
 SDO *parseSDO(const CANmesg *mesg, SDO *sdo);
@@ -89,6 +134,10 @@ SDO *readSDOvalue(uint16_t idx, uint8_t subidx, uint8_t NID, SDO *sdo);
 int64_t getSDOval(const SDO *sdo, const SDO_dic_entry *e, const abortcodes **ac);
 CANmesg *SDO_read(const SDO_dic_entry *e, uint8_t NID, CANmesg *cm);
 CANmesg *SDO_write(const SDO_dic_entry *e, uint8_t NID, int64_t data, CANmesg *cm);
+CANmesg *SDO_abort(uint8_t NID, uint16_t idx, uint8_t subidx, uint32_t code, CANmesg *cm);
+const char *SDO_abortmsg(uint32_t code);
+EMCY *parseEMCY(const CANmesg *mesg, EMCY *emcy);
+const char *EMCY_class(uint16_t code);
 
 //int SDO_readByte(uint16_t idx, uint8_t subidx, uint8_t *data, uint8_t NID);
 #endif // CANOPEN_H__
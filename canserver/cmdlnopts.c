@@ -44,6 +44,8 @@ glob_pars const Gdefault = {
     .port = DEFAULT_PORT,
     .terminal = 0,
     .echo = 0,
+    .txdepth = 4,
+    .maxclients = 10,
     .logfile = NULL,
     .rest_pars = NULL,
     .rest_pars_num = 0
@@ -60,11 +62,20 @@ myoption cmdlnopts[] = {
     {"vid",     NEED_ARG,   NULL,   'V',    arg_string, APTR(&G.vid),       _("serial device vendor ID (default: none)")},
     {"pid",     NEED_ARG,   NULL,   'P',    arg_string, APTR(&G.pid),       _("serial device product ID (default: none)")},
     {"port",    NEED_ARG,   NULL,   'p',    arg_string, APTR(&G.port),      _("network port to connect (default: " DEFAULT_PORT ")")},
+    {"unixsock",NEED_ARG,   NULL,   'u',    arg_string, APTR(&G.unixsock),  _("also listen local SOCK_SEQPACKET socket with given path (default: none)")},
     {"logfile", NEED_ARG,   NULL,   'l',    arg_string, APTR(&G.logfile),   _("save logs to file (default: none)")},
     {"echo",    NO_ARGS,    NULL,   'e',    arg_int,    APTR(&G.echo),      _("echo users commands back")},
     {"pidfile", NEED_ARG,   NULL,   0,      arg_string, APTR(&G.pidfile),   _("name of PID file (default: " DEFAULT_PIDFILE ")")},
+    {"shmname", NEED_ARG,   NULL,   0,      arg_string, APTR(&G.shmname),   _("name of shared memory object with motors' state table (e.g. /canserver; default: none)")},
     {"verbose", NO_ARGS,    NULL,   'v',    arg_none,   APTR(&G.verb),      _("increase verbosity level of log file (each -v increased by 1)")},
     {"speed",   NEED_ARG,   NULL,   's',    arg_int,    APTR(&G.speed),     _("set CANbus speed")},
+    {"canif",   NEED_ARG,   NULL,   'c',    arg_string, APTR(&G.canif),     _("SocketCAN interface name (e.g. can0 or vcan0) to use instead of serial device")},
+    {"binary",  NO_ARGS,    NULL,   0,      arg_int,    APTR(&G.binary),    _("try binary framing of USB-CAN adapter link (for new adapter firmware)")},
+    {"txdepth", NEED_ARG,   NULL,   't',    arg_int,    APTR(&G.txdepth),   _("max amount of frames waiting for adapter's echo in ASCII mode (1..16, default: 4)")},
+    {"reactor", NO_ARGS,    NULL,   'r',    arg_int,    APTR(&G.reactor),   _("process all motors by single event loop thread instead of thread per motor")},
+    {"maxclients",NEED_ARG, NULL,   'm',    arg_int,    APTR(&G.maxclients),_("max amount of connected clients (0 - unlimited, default: 10)")},
+    {"syncperiod",NEED_ARG, NULL,   0,      arg_int,    APTR(&G.syncperiod),_("send SYNC each given amount of milliseconds (default: 0 - only by `gmove`)")},
+    {"hbperiod",NEED_ARG,   NULL,   0,      arg_int,    APTR(&G.hbperiod),  _("monitor heartbeats of motors' nodes: max interval between them (ms), nodes produce them twice per interval (default: 0 - don't monitor)")},
     end_option
 };
 
@@ -30,14 +30,23 @@
 typedef struct{
     char *pidfile;          // name of PID file (default: /tmp/canserver.pid)
     char *device;           // serial device name
+    char *canif;            // SocketCAN interface name
     char *vid;              // vendor id
     char *pid;              // product id
     char *port;             // port to connect
+    char *unixsock;         // path to local (UNIX) socket or NULL
+    char *shmname;          // name of shared memory object with motors' state or NULL
     char *logfile;          // logfile name
     int speed;              // CANbus speed
     int verb;               // increase logfile verbosity level
     int terminal;           // run as terminal
     int echo;               // echo user commands back
+    int binary;             // try binary framing of USB-CAN adapter link
+    int txdepth;            // max amount of frames waiting for adapter's echo
+    int reactor;            // process all motors by single event loop thread
+    int maxclients;         // max amount of connected clients (0 - unlimited)
+    int syncperiod;         // period of SYNC messages (ms), 0 - don't send
+    int hbperiod;           // heartbeat period of nodes (ms), 0 - don't monitor
     int rest_pars_num;      // number of rest parameters
     char** rest_pars;       // the rest parameters: array of char* (path to logfile and thrash)
 } glob_pars;
@@ -0,0 +1,127 @@
+/*
+ * This file is part of the CANserver project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Heartbeat consumer: nodes with configured heartbeat producer are monitored by the time of
+ * their last heartbeat; NMT state changes and heartbeat losses are sent to all clients
+ * as "heartbeat> ..." messages. Frames are processed by CAN receiver, timeouts - by CANserver.
+ */
+
+#include <stdio.h>
+#include <usefull_macros.h>
+
+#include "heartbeat.h"
+#include "socket.h"
+
+// NMT state is unknown (no heartbeats since monitoring start)
+#define NMT_UNKNOWN     (-1)
+
+typedef struct{
+    double period;      // max interval between heartbeats (s), 0 - node isn't monitored
+    double last;        // time of last heartbeat (or monitoring start)
+    int state;          // last NMT state
+    int lost;           // ==1 if heartbeat is lost
+} hbnode;
+
+static hbnode nodes[NODEID_MASK + 1];
+
+/**
+ * @brief hb_statename - name of NMT state
+ * @param state - state from heartbeat
+ * @return name
+ */
+const char *hb_statename(int state){
+    switch(state){
+        case NMT_BOOTUP:
+            return "boot-up";
+        case NMT_STOPPED:
+            return "stopped";
+        case NMT_OPERATIONAL:
+            return "operational";
+        case NMT_PREOPERATIONAL:
+            return "pre-operational";
+        default:
+            return "unknown";
+    }
+}
+
+// send event to all clients and log it
+static void hb_event(const char *fmt, int NID, const char *state){
+    char buf[128];
+    snprintf(buf, 128, fmt, NID, state);
+    LOGWARN("%s", buf);
+    mesgAddText(&ServerMessages, buf);
+}
+
+/**
+ * @brief hb_monitor - start or stop monitoring of node's heartbeat
+ * @param NID    - node ID
+ * @param period - max interval between heartbeats of node (ms), 0 to stop monitoring
+ */
+void hb_monitor(uint8_t NID, int period){
+    if(NID > NODEID_MASK || period < 0) return;
+    hbnode *n = &nodes[NID];
+    double t = dtime(), p = period / 1000.;
+    __atomic_store_n(&n->lost, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&n->state, NMT_UNKNOWN, __ATOMIC_RELAXED);
+    __atomic_store(&n->last, &t, __ATOMIC_RELAXED);
+    __atomic_store(&n->period, &p, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief hb_process - check if message is heartbeat and store state of its node
+ * @param mesg - message from CAN bus
+ * @return HB_BOOTUP if any node sent boot-up (even not monitored: it lost configuration),
+ *      HB_FRAME if it's other heartbeat of monitored node, HB_NONE if not
+ */
+int hb_process(const CANmesg *mesg){
+    if((mesg->ID & COBID_MASK) != HEARTB_COBID || mesg->len != 1) return HB_NONE;
+    int NID = mesg->ID & NODEID_MASK;
+    int state = mesg->data[0] & 0x7F;
+    hbnode *n = &nodes[NID];
+    double p, t = dtime();
+    __atomic_load(&n->period, &p, __ATOMIC_ACQUIRE);
+    if(p <= 0.) return (state == NMT_BOOTUP) ? HB_BOOTUP : HB_NONE;
+    __atomic_store(&n->last, &t, __ATOMIC_RELEASE);
+    int old = __atomic_exchange_n(&n->state, state, __ATOMIC_RELAXED);
+    if(__atomic_exchange_n(&n->lost, 0, __ATOMIC_ACQ_REL))
+        hb_event("heartbeat> node %d is back, state=%s", NID, hb_statename(state));
+    else if(old != state)
+        hb_event("heartbeat> node %d state=%s", NID, hb_statename(state));
+    return (state == NMT_BOOTUP) ? HB_BOOTUP : HB_FRAME;
+}
+
+/**
+ * @brief hb_check - find nodes with lost heartbeat
+ * @param tmout (io) - max time to wait for next event; decreased to the nearest heartbeat deadline
+ */
+void hb_check(double *tmout){
+    double t = dtime();
+    for(int i = 1; i <= NODEID_MASK; ++i){
+        hbnode *n = &nodes[i];
+        double p, last;
+        __atomic_load(&n->period, &p, __ATOMIC_ACQUIRE);
+        if(p <= 0. || __atomic_load_n(&n->lost, __ATOMIC_RELAXED)) continue;
+        __atomic_load(&n->last, &last, __ATOMIC_ACQUIRE);
+        double dt = last + p - t;
+        if(dt > 0.){
+            if(dt < *tmout) *tmout = dt;
+        }else if(!__atomic_exchange_n(&n->lost, 1, __ATOMIC_ACQ_REL))
+            hb_event("heartbeat> node %d lost (last state=%s)", i, hb_statename(__atomic_load_n(&n->state, __ATOMIC_RELAXED)));
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ * This file is part of the CANserver project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef HEARTBEAT_H__
+#define HEARTBEAT_H__
+
+#include <stdint.h>
+
+#include "canopen.h"
+
+// node produces heartbeat this times per monitored period: heartbeat is lost if there's no one
+// during the period, so one late or missed frame isn't a loss
+#define HB_PRODUCER_DIV     (2)
+// heartbeat producer time (object 0x1017, ms) for monitored period `p` (ms)
+#define HB_PRODUCER_TIME(p) (((p) + HB_PRODUCER_DIV - 1) / HB_PRODUCER_DIV)
+
+// return values of hb_process
+#define HB_NONE             (0)
+#define HB_FRAME            (1)
+// node sent boot-up message (it was restarted and lost its configuration)
+#define HB_BOOTUP           (2)
+
+void hb_monitor(uint8_t NID, int period);
+int hb_process(const CANmesg *mesg);
+void hb_check(double *tmout);
+const char *hb_statename(int state);
+
+#endif // HEARTBEAT_H__
@@ -20,15 +20,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>   // shm_unlink
 #include <sys/wait.h>   // wait
 #include <sys/prctl.h>  // prctl
 #include <unistd.h>     // daemon
 #include <usefull_macros.h>
 
 #include "aux.h"
+#include "canbus.h"
 #include "cmdlnopts.h"
 #include "socket.h"
 #include "processmotors.h"
+#include "shmstate.h"
 
 glob_pars *GP; // non-static: to use in outhern functions
 static pid_t childpid;
@@ -37,6 +40,8 @@ void signals(int signo){
     //restore_tty();
     if(childpid){ // unlink PID-file only from father
         unlink(GP->pidfile);
+        if(GP->unixsock) unlink(GP->unixsock);
+        if(GP->shmname) shm_unlink(GP->shmname);
         LOGERR("Exit with status %d", signo);
     }
     exit(signo);
@@ -53,16 +58,26 @@ int main(int argc, char **argv){
 #endif
     initial_setup();
     GP = parse_args(argc, argv);
-    if(!GP->device && !GP->vid && !GP->pid) red("No device PID/VID/filename given, try to find firs comer!\n");
   /*  if(GP->checkfile){ // just check and exit
         return parse_data_file(GP->checkfile, 0);
     }*/
-    char *dev = find_device();
-    if(!dev) ERRX("Serial device not found!");
-    FREE(dev);
-    if(!GP->speed) ERRX("Point CANbus speed");
-    if(GP->speed < 10 || GP->speed > 3000) ERRX("Wrong CANbus speed value: %d, shold be 10..3000", GP->speed);
+    if(GP->canif){ // SocketCAN: bitrate is set by system
+        canbus_setbackend(CANBUS_SOCKETCAN);
+        if(canbus_open(GP->canif)) ERRX("Can't open CAN interface %s", GP->canif);
+        canbus_close();
+    }else{
+        if(!GP->device && !GP->vid && !GP->pid) red("No device PID/VID/filename given, try to find firs comer!\n");
+        char *dev = find_device();
+        if(!dev) ERRX("Serial device not found!");
+        FREE(dev);
+        if(!GP->speed) ERRX("Point CANbus speed");
+    }
+    if(GP->speed && (GP->speed < 10 || GP->speed > 3000)) ERRX("Wrong CANbus speed value: %d, shold be 10..3000", GP->speed);
     setCANspeed(GP->speed);
+    setbinarymode(GP->binary);
+    setTXdepth(GP->txdepth);
+    if(GP->syncperiod < 0) ERRX("Wrong SYNC period: %d", GP->syncperiod);
+    if(GP->hbperiod < 0 || GP->hbperiod > 0xffff) ERRX("Wrong heartbeat period: %d", GP->hbperiod);
     signal(SIGTERM, signals); // kill (-15) - quit
     signal(SIGHUP, SIG_IGN);  // hup - ignore
     signal(SIGINT, signals);  // ctrl+C - quit
@@ -98,6 +113,14 @@ int main(int argc, char **argv){
         }
     }
     #endif
+    if(GP->reactor && startReactor()){
+        LOGERR("Can't run reactor thread");
+        ERRX("Can't run reactor thread");
+    }
+    if(GP->shmname && shmstate_open(GP->shmname)){
+        LOGERR("Can't create shared memory %s", GP->shmname);
+        ERRX("Can't create shared memory %s", GP->shmname);
+    }
     daemonize(GP->port);
     return 0;
 }
@@ -0,0 +1,136 @@
+/*
+ * This file is part of the CANserver project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// process data objects: mapping of TPDO1/RPDO1 of nodes, decoding and forming of frames
+
+#include <pthread.h>
+#include <string.h>
+
+#include "pdo.h"
+
+// mapping of PDO: objects in order of their placing in frame
+typedef struct{
+    const SDO_dic_entry *entry[PDO_MAXMAP];
+    int n;                  // amount of objects (0 - PDO isn't used)
+    uint32_t seq;           // seqlock: odd while mapping is changing
+} pdomap;
+
+// TPDO1 & RPDO1 mapping of each node (changed by role threads and CAN receiver under `mapmutex`,
+// read without locking by seqlock)
+static pdomap maps[2][NODEID_MASK + 1];
+static pthread_mutex_t mapmutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief getmap - get consistent copy of mapping
+ * @param m - mapping
+ * @param entry (o) - objects
+ * @return their amount
+ */
+static int getmap(pdomap *m, const SDO_dic_entry *entry[PDO_MAXMAP]){
+    while(1){
+        uint32_t seq = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE);
+        if(seq & 1) continue; // mapping is changing now
+        int n = __atomic_load_n(&m->n, __ATOMIC_RELAXED);
+        for(int i = 0; i < n; ++i) entry[i] = __atomic_load_n(&m->entry[i], __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&m->seq, __ATOMIC_RELAXED) == seq) return n;
+    }
+}
+
+/**
+ * @brief pdo_mapentry - value of PDO mapping parameter for dictionary entry
+ * @param e - entry
+ * @return index, subindex and length in bits
+ */
+uint32_t pdo_mapentry(const SDO_dic_entry *e){
+    return ((uint32_t)e->index << 16) | ((uint32_t)e->subindex << 8) | (uint32_t)(e->datasize * 8);
+}
+
+/**
+ * @brief pdo_setmap - remember objects mapped into PDO of node (after its configuration)
+ * @param NID     - node ID
+ * @param dir     - PDO_TX or PDO_RX
+ * @param entries - mapped objects in order of their placing in PDO
+ * @param n       - their amount (0 - PDO isn't used)
+ * @return 0 if all OK
+ */
+int pdo_setmap(uint8_t NID, pdo_dir dir, const SDO_dic_entry * const *entries, int n){
+    if(NID > NODEID_MASK || n < 0 || n > PDO_MAXMAP) return 1;
+    int sz = 0;
+    for(int i = 0; i < n; ++i){
+        if(!entries[i] || !entries[i]->datasize) return 1; // strings can't be mapped
+        sz += entries[i]->datasize;
+    }
+    if(sz > 8) return 1;
+    pdomap *m = &maps[dir][NID];
+    pthread_mutex_lock(&mapmutex);
+    uint32_t seq = m->seq;
+    __atomic_store_n(&m->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for(int i = 0; i < n; ++i) __atomic_store_n(&m->entry[i], entries[i], __ATOMIC_RELAXED);
+    __atomic_store_n(&m->n, n, __ATOMIC_RELAXED);
+    __atomic_store_n(&m->seq, seq + 2, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mapmutex);
+    return 0;
+}
+
+/**
+ * @brief pdo_unpack - decode TPDO1 frame into values of mapped objects
+ * @param mesg - message from CAN bus
+ * @param sdo (o) - values (like SDO upload answers)
+ * @param max  - max amount of values
+ * @return amount of values or 0 if it isn't TPDO1 with known mapping
+ */
+int pdo_unpack(const CANmesg *mesg, SDO *sdo, int max){
+    if((mesg->ID & COBID_MASK) != TPDO1_COBID) return 0;
+    uint8_t NID = mesg->ID & NODEID_MASK;
+    const SDO_dic_entry *entry[PDO_MAXMAP];
+    int n = getmap(&maps[PDO_TX][NID], entry), pos = 0;
+    if(n > max) n = max;
+    for(int i = 0; i < n; ++i){
+        const SDO_dic_entry *e = entry[i];
+        if(pos + e->datasize > mesg->len) return i; // short frame
+        sdo[i].NID = NID;
+        sdo[i].ccs = CCS_INIT_UPLOAD;
+        sdo[i].index = e->index;
+        sdo[i].subindex = e->subindex;
+        sdo[i].datalen = e->datasize;
+        memset(sdo[i].data, 0, 4);
+        memcpy(sdo[i].data, mesg->data + pos, e->datasize);
+        pos += e->datasize;
+    }
+    return n;
+}
+
+/**
+ * @brief pdo_pack - form RPDO1 frame writing object `e` (if RPDO1 of node maps only this object)
+ * @param NID  - node ID
+ * @param e    - object
+ * @param val  - its value
+ * @param mesg (o) - frame
+ * @return `mesg` or NULL if object can't be written by PDO
+ */
+CANmesg *pdo_pack(uint8_t NID, const SDO_dic_entry *e, int64_t val, CANmesg *mesg){
+    if(!e || !mesg || NID > NODEID_MASK) return NULL;
+    const SDO_dic_entry *entry[PDO_MAXMAP];
+    if(getmap(&maps[PDO_RX][NID], entry) != 1 || entry[0] != e) return NULL;
+    mesg->ID = RPDO1_COBID + NID;
+    mesg->len = e->datasize;
+    for(int i = 0; i < e->datasize; ++i) mesg->data[i] = (val >> (8*i)) & 0xff;
+    return mesg;
+}
@@ -0,0 +1,41 @@
+/*
+ * This file is part of the CANserver project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef PDO_H__
+#define PDO_H__
+
+#include <stdint.h>
+
+#include "canopen.h"
+
+// max amount of objects mapped into one PDO (8 bytes of 1-byte objects)
+#define PDO_MAXMAP          (8)
+
+// PDO direction
+typedef enum{
+    PDO_TX,     // TPDO1: node -> server
+    PDO_RX      // RPDO1: server -> node
+} pdo_dir;
+
+uint32_t pdo_mapentry(const SDO_dic_entry *e);
+int pdo_setmap(uint8_t NID, pdo_dir dir, const SDO_dic_entry * const *entries, int n);
+int pdo_unpack(const CANmesg *mesg, SDO *sdo, int max);
+CANmesg *pdo_pack(uint8_t NID, const SDO_dic_entry *e, int64_t val, CANmesg *mesg);
+
+#endif // PDO_H__
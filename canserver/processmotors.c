@@ -19,15 +19,21 @@
 #include "aux.h"
 #include "canopen.h"
 #include "cmdlnopts.h"
+#include "heartbeat.h"
+#include "pdo.h"
 #include "processmotors.h"
 #include "pusirobot.h"
+#include "sdomanager.h"
+#include "shmstate.h"
 #include "socket.h"
 
 #include <fcntl.h>      // open
 #include <inttypes.h>   // PRId64
 #include <stdio.h>      // printf
 #include <string.h>     // strcmp
+#include <sys/eventfd.h> // eventfd
 #include <sys/stat.h>   // open
+#include <time.h>       // clock_nanosleep
 #include <unistd.h>     // usleep
 #include <usefull_macros.h>
 
@@ -38,8 +44,41 @@ static int CANspeed = 0; // default speed, if !=0 set it when connected
 
 // all messages are in format "ID [data]"
 static message CANbusMessages = {0}; // CANserver thread is master
-#define CANBUSPUSH(mesg)    mesgAddObj(&CANbusMessages, mesg, sizeof(CANmesg))
-#define CANBUSPOP()         mesgGetObj(&CANbusMessages, NULL)
+static int txevfd = -1; // wake up CANserver when CANbusMessages got new data or SDO manager have next request
+#define CANBUSPUSH(ti, mesg) canbuspush(ti, mesg)
+#define CANBUSPOP(mesg)     mesgGetBuf(&CANbusMessages, NULL, mesg, sizeof(CANmesg))
+
+// key of tagged SDO request
+#define SDOKEY(NID, idx, subidx)    (((uint32_t)(NID) << 24) | ((uint32_t)(idx) << 8) | (uint32_t)(subidx))
+
+/**
+ * @brief canbuspush - send message to CAN bus, remember tag of current command for SDO request
+ * @param ti   - thread sending message
+ * @param mesg - message
+ * @return pointer to queued data or NULL
+ * Requests of role itself (e.g. reading of errors after EMCY) are remembered as untagged, so
+ * their answers don't take tags of client's requests
+ */
+static void *canbuspush(threadinfo *ti, CANmesg *mesg){
+    if((mesg->ID & ~NODEID_MASK) == RSDO_COBID && mesg->len > 3)
+        tagRequest(ti, SDOKEY(mesg->ID & NODEID_MASK, mesg->data[1] | (mesg->data[2] << 8), mesg->data[3]));
+    return mesgAddObj(&CANbusMessages, MESG_CAN, mesg, sizeof(CANmesg));
+}
+
+// send SYNC to CAN bus (all RPDO received with synchronous transmission type are actuated by it)
+static void sendSYNC(){
+    CANmesg sync = {.ID = SYNC_COBID, .len = 0};
+    mesgAddObj(&CANbusMessages, MESG_CAN, &sync, sizeof(CANmesg));
+}
+
+// send text to all clients; prefix it by `@tag` if `tag` isn't empty
+static void tagmesg(const char *tag, char *txt){
+    if(tag && *tag){
+        char buf[MESGTEXT_MAX];
+        snprintf(buf, MESGTEXT_MAX, "@%s %s", tag, txt);
+        mesgAddText(&ServerMessages, buf);
+    }else mesgAddText(&ServerMessages, txt);
+}
 
 // commands sent to threads
 // each threadCmd array should be terminated with NULLs; default command `help` shows all names/descriptions
@@ -50,20 +89,28 @@ typedef struct{
     char *descr;    // description for help
 } threadCmd;
 
-// basic threads
+// basic roles
 // messages: master - thread, slave - caller
-static void *stpemulator(void *arg);
-static void *rawcommands(void *arg);
-static void *canopencmds(void *arg);
-static void *simplestp(void *arg);
+static void stpemulator_cmd(threadinfo *ti, char *mesg);
+static void stpemulator_timer(threadinfo *ti);
+static void rawcommands_cmd(threadinfo *ti, char *mesg);
+static void rawcommands_ans(threadinfo *ti, const CANmesg *ans);
+static void canopencmds_cmd(threadinfo *ti, char *mesg);
+static void canopencmds_ans(threadinfo *ti, const CANmesg *ans);
+static void canopencmds_sdodata(threadinfo *ti, const SDOdata *d);
+static void simplestp_init(threadinfo *ti);
+static void simplestp_cmd(threadinfo *ti, char *mesg);
+static void simplestp_ans(threadinfo *ti, const CANmesg *ans);
+static void simplestp_sdodata(threadinfo *ti, const SDOdata *d);
+static void simplestp_timer(threadinfo *ti);
 
 // handlers for standard types
 thread_handler CANhandlers[] = {
-    {"canopen", canopencmds, "NodeID index subindex [data] - raw CANOpen commands with `index` and `subindex` to `NodeID`"},
-    {"emulation", stpemulator, "(args) - stepper emulation"},
-    {"raw", rawcommands, "ID [DATA] - raw CANbus commands to raw `ID` with `DATA`"},
-    {"stepper", simplestp, "(args) - simple stepper motor: no limit switches, only goto"},
-    {NULL, NULL, NULL}
+    {"canopen", NULL, canopencmds_cmd, canopencmds_ans, canopencmds_sdodata, NULL, "NodeID index subindex [data] - raw CANOpen commands with `index` and `subindex` to `NodeID`"},
+    {"emulation", NULL, stpemulator_cmd, NULL, NULL, stpemulator_timer, "(args) - stepper emulation"},
+    {"raw", NULL, rawcommands_cmd, rawcommands_ans, NULL, NULL, "ID [DATA] - raw CANbus commands to raw `ID` with `DATA`"},
+    {"stepper", simplestp_init, simplestp_cmd, simplestp_ans, simplestp_sdodata, simplestp_timer, "(args) - simple stepper motor: no limit switches, only goto"},
+    {NULL, NULL, NULL, NULL, NULL, NULL, NULL}
 };
 
 thread_handler *get_handler(const char *name){
@@ -83,6 +130,103 @@ thread_handler *get_handler(const char *name){
 // clear errors
 #define CMDPAR_CLEARERR         (-4)
 
+/*
+ * Stackless coroutines (protothreads) of role instances: sequences like "send SDO, wait
+ * for answer, send next" are written linearly, but run as part of role callbacks (in own
+ * thread of instance or in reactor). Local variables don't survive `await_sdo`, so use
+ * fields of `coro` or role data. Each coroutine:
+ *      static int fn(coro *c, threadinfo *ti){
+ *          CORO_BEGIN(c);
+ *          ...; await_sdo(c, &ENTRY, NID); if(c->gotsdo) ...;
+ *          CORO_END(c);
+ *      }
+ */
+// coroutine should be resumed later / finished
+#define CORO_WAIT               (0)
+#define CORO_DONE               (1)
+// max amount of simultaneous coroutines per role instance
+#define CORO_MAX                (8)
+
+typedef struct coro_{
+    int line;                                   // resume point (0 - start)
+    int (*fn)(struct coro_ *c, threadinfo *ti); // coroutine body (NULL - slot is free)
+    const SDO_dic_entry *await;                 // SDO awaited (or NULL)
+    uint8_t nid;                                // node ID of awaited SDO
+    int gotsdo;                                 // ==1 if awaited SDO received, 0 if timeout
+    SDO sdo;                                    // SDO received
+    double deadline;                            // timeout of awaiting
+    char tag[TAGMAXLEN+1];                      // tag of command started coroutine
+    long local[4];                              // "local variables" of coroutine
+} coro;
+
+#define CORO_BEGIN(c)           switch((c)->line){ case 0:
+#define CORO_END(c)             } (c)->line = 0; return CORO_DONE
+// SDO manager answers (maybe by abort) to each request, so this timeout is only for safety
+#define CORO_SDO_TMOUT          (SDO_ANS_TIMEOUT * (SDO_RETRIES + 2))
+// wait for answer of SDO `entry` from node `NID` (CORO_SDO_TMOUT max), result in c->gotsdo/c->sdo
+#define await_sdo(c, entry, NID)  do{ (c)->await = (entry); (c)->nid = (NID); (c)->gotsdo = 0;  \
+        (c)->deadline = dtime() + CORO_SDO_TMOUT; (c)->line = __LINE__;                         \
+        __attribute__((fallthrough)); case __LINE__:                                            \
+        if(!(c)->gotsdo && dtime() < (c)->deadline) return CORO_WAIT;                           \
+        (c)->await = NULL; }while(0)
+
+// set of coroutines of role instance
+typedef struct{
+    coro c[CORO_MAX];
+} coro_sched;
+
+// resume coroutine and free its slot when finished; requests sent by coroutine have tag of its command
+static void coro_resume(coro *c, threadinfo *ti){
+    char tag[TAGMAXLEN+1];
+    strcpy(tag, ti->tag);
+    strcpy(ti->tag, c->tag);
+    if(c->fn(c, ti) == CORO_DONE) memset(c, 0, sizeof(coro));
+    else if(c->await && c->deadline < ti->nexttimer) ti->nexttimer = c->deadline; // wake up @ timeout
+    strcpy(ti->tag, tag);
+}
+
+/**
+ * @brief coro_start - run new coroutine
+ * @param s  - scheduler
+ * @param fn - coroutine
+ * @param ti - role instance
+ * @return 0 if all OK, 1 if no free slots
+ */
+static int coro_start(coro_sched *s, int (*fn)(coro *c, threadinfo *ti), threadinfo *ti){
+    for(int i = 0; i < CORO_MAX; ++i){
+        coro *c = &s->c[i];
+        if(c->fn) continue;
+        c->fn = fn;
+        strcpy(c->tag, ti->tag);
+        coro_resume(c, ti);
+        return 0;
+    }
+    return 1;
+}
+
+// resume coroutines waiting for given SDO
+static void coro_sdo(coro_sched *s, const SDO *sdo, threadinfo *ti){
+    for(int i = 0; i < CORO_MAX; ++i){
+        coro *c = &s->c[i];
+        if(!c->fn || !c->await) continue;
+        if(c->nid != sdo->NID || c->await->index != sdo->index || c->await->subindex != sdo->subindex) continue;
+        c->sdo = *sdo;
+        c->gotsdo = 1;
+        coro_resume(c, ti);
+    }
+}
+
+// resume coroutines which awaiting timed out
+static void coro_timeouts(coro_sched *s, threadinfo *ti){
+    double t = dtime();
+    for(int i = 0; i < CORO_MAX; ++i){
+        coro *c = &s->c[i];
+        if(!c->fn) continue;
+        if(!c->await || t >= c->deadline) coro_resume(c, ti);
+        else if(c->deadline < ti->nexttimer) ti->nexttimer = c->deadline;
+    }
+}
+
 /**
  * @brief cmdParser - parser of user's comands
  * @param cmdlist - NULL-terminated array with possible commands
@@ -166,17 +310,25 @@ static int parsePacket(CANmesg *packet, char *data){
     return 0;
 }
 
-// [re]open serial device
+// [re]open serial device or SocketCAN interface
 static void reopen_device(){
     char *devname = NULL;
     double t0 = dtime();
     canbus_close();
     DBG("Try to [re]open serial device");
     while(dtime() - t0 < 5.){
-        if((devname = find_device())) break;
+        if(GP->canif){
+            if(!canbus_open(GP->canif)) break;
+        }else if((devname = find_device())) break;
         usleep(1000);
     }
-    if(!devname || canbus_open(devname)){
+    if(GP->canif){
+        if(canbus_disconnected()){
+            LOGERR("Can't open CAN interface %s", GP->canif);
+            ERRX("Can't open CAN interface %s", GP->canif);
+        }
+        DBG("Opened interface: %s", GP->canif);
+    }else if(!devname || canbus_open(devname)){
         FREE(devname);
         LOGERR("Can't find serial device");
         ERRX("Can't find serial device");
@@ -189,197 +341,417 @@ static void reopen_device(){
     FREE(devname);
 }
 
+/**
+ * @brief fmtEMCY - text of emergency: error code with its class, error register and raw manufacturer specific field
+ * @param e   - emergency
+ * @param buf (o) - text
+ * Meaning of manufacturer specific field depends on device, so roles read it by SDO (ERRSTATE/DEVSTATUS)
+ */
+static void fmtEMCY(const EMCY *e, char buf[128]){
+    snprintf(buf, 128, "emcy=0x%04X class='%s' errreg=0x%02X data=%02X%02X%02X%02X%02X",
+             e->code, EMCY_class(e->code), e->errreg, e->data[0], e->data[1], e->data[2], e->data[3], e->data[4]);
+}
+
 // do something with can message: send to receiver
 static void processCANmessage(CANmesg *mesg){
-    threadinfo *ti = findThreadByID(0);
-    if(ti){
-        mesgAddObj(&ti->answers, (void*)mesg, sizeof(CANmesg));
+    SDO pdo[PDO_MAXMAP];
+    int hb = hb_process(mesg);
+    if(hb != HB_NONE){
+        uint8_t NID = mesg->ID & NODEID_MASK;
+        shmstate_nmt(NID, mesg->data[0] & 0x7F);
+        if(hb == HB_BOOTUP){ // node was restarted and lost PDO configuration: use SDO until role restores it
+            pdo_setmap(NID, PDO_TX, NULL, 0);
+            pdo_setmap(NID, PDO_RX, NULL, 0);
+        }
+        // boot-up is sent to role of this node (its ID is TSDO of node) to restore configuration
+        dispatchToThreads((hb == HB_BOOTUP) ? (TSDO_COBID | NID) : (int)mesg->ID, MESG_CAN, (void*)mesg, sizeof(CANmesg));
+        return;
     }
-    ti = findThreadByID(mesg->ID);
-    if(ti){
-        mesgAddObj(&ti->answers, (void*) mesg, sizeof(CANmesg));
+    EMCY emcy;
+    if(parseEMCY(mesg, &emcy)){ // emergency: send to role of this node (its ID is TSDO of node)
+        LOGWARN("Node %d: EMCY 0x%04X, error register 0x%02X", emcy.NID, emcy.code, emcy.errreg);
+        if(!dispatchToThreads(TSDO_COBID | emcy.NID, MESG_CAN, (void*)mesg, sizeof(CANmesg))){ // no role: send to all
+            char buf[MESGTEXT_MAX], txt[128];
+            fmtEMCY(&emcy, txt);
+            snprintf(buf, MESGTEXT_MAX, "emcy> node %d %s", emcy.NID, txt);
+            mesgAddText(&ServerMessages, buf);
+        }
+        return;
     }
+    int n = pdo_unpack(mesg, pdo, PDO_MAXMAP);
+    if(n){ // TPDO with known mapping: store state and send to role of this node (its ID is TSDO of node)
+        for(int i = 0; i < n; ++i) shmstate_sdo(&pdo[i]);
+        dispatchToThreads(TSDO_COBID | (mesg->ID & NODEID_MASK), MESG_CAN, (void*)mesg, sizeof(CANmesg));
+        return;
+    }
+    shmstate_update(mesg);
+    int r = sdomgr_answer(mesg);
+    if(r & SDOMGR_WAKE) eventfd_write(txevfd, 1); // send next SDO message of this node
+    if(r & SDOMGR_HIDE) return; // a part of segmented transfer
+    dispatchToThreads(mesg->ID, MESG_CAN, (void*)mesg, sizeof(CANmesg));
 }
 
 /**
- * @brief CANserver - main CAN thread; receive/transmit raw messages by CANbusMessages
+ * @brief updateCANfilters - set CAN bus receive filters by IDs of all registered threads
+ * Thread with ID==0 listens for all messages, so in that case filters are cleared;
+ * threads with TSDO ID of node also receive TPDO1 of that node; emergencies and heartbeats of all
+ * nodes are received by two masked filters (boot-up is needed to configure node again even if
+ * heartbeats aren't monitored)
+ */
+void updateCANfilters(){
+    canfilter f[CANFILTERS_MAX];
+    int n = 0;
+    threadlist *list = NULL;
+    lockThreadList();
+    while((list = nextThread(list))){
+        if(list->ti.ID == 0 || n == CANFILTERS_MAX){ // receive all
+            n = 0;
+            break;
+        }
+        if(list->ti.ID >= CANIDS_MAX) continue; // not CAN ID
+        f[n].ID = (uint16_t)list->ti.ID;
+        f[n++].mask = 0x7ff;
+        if((list->ti.ID & COBID_MASK) == TSDO_COBID && n < CANFILTERS_MAX){
+            f[n].ID = (uint16_t)(TPDO1_COBID | (list->ti.ID & NODEID_MASK));
+            f[n++].mask = 0x7ff;
+        }
+    }
+    unlockThreadList();
+    if(n){
+        canfilter all[2] = {{.ID = EMERG_COBID, .mask = COBID_MASK}, {.ID = HEARTB_COBID, .mask = COBID_MASK}};
+        if(n + 2 > CANFILTERS_MAX) n = 0; // receive all
+        else for(int i = 0; i < 2; ++i) f[n++] = all[i];
+    }
+    DBG("Set %d CAN filters", n);
+    canbus_setfilters(f, n);
+}
+
+/**
+ * @brief CANreceiver - receive raw messages from CAN bus and send them to role threads
  * @param data - unused
  * @return unused
+ * Device [re]opening is made by CANserver, here we only wait while it's disconnected
  */
-void *CANserver(_U_ void *data){
-    reopen_device();
+static void *CANreceiver(_U_ void *data){
     while(1){
-        CANmesg *msg = CANBUSPOP();
-        if(msg){
-            if(canbus_write(msg)){
-                LOGWARN("Can't write to CANbus, try to reopen");
-                WARNX("Can't write to canbus");
-                if(canbus_disconnected()) reopen_device();
-            }
-            FREE(msg);
-        }
         CANmesg cm = {0};
         if(!canbus_read(&cm)){ // got raw message from CAN bus - parse it
             DBG("Got CAN message from 0x%03X, len: %d", cm.ID, cm.len);
             processCANmessage(&cm);
-        }else if(canbus_disconnected()) reopen_device();
+        }else if(canbus_disconnected()) usleep(1000);
     }
-    LOGERR("CANserver(): UNREACHABLE CODE REACHED!");
+    LOGERR("CANreceiver(): UNREACHABLE CODE REACHED!");
     return NULL;
 }
 
 /**
- * @brief stpemulator - stepper motor emulator
- * @param arg - threadinfo
+ * @brief SYNCproducer - send SYNC each GP->syncperiod milliseconds
+ * @param data - unused
  * @return unused
+ * Moments of sending are counted from the start (not from previous SYNC), so period don't drift
  */
-static void *stpemulator(void *arg){
-    threadinfo *ti = (threadinfo*)arg;
+static void *SYNCproducer(_U_ void *data){
+    struct timespec t;
+    long period = GP->syncperiod * 1000000L;
+    clock_gettime(CLOCK_MONOTONIC, &t);
     while(1){
-        char *mesg = mesgGetText(&ti->commands);
-        if(mesg){
-            DBG("Stepper emulator got: %s", mesg);
-            mesgAddText(&ServerMessages, mesg);
-            /* do something */
-            FREE(mesg);
-        }
-        int r100 = rand() % 10000;
-        if(r100 < 1){ // 10% of probability
-            mesgAddText(&ServerMessages, "stpemulator works fine!");
+        t.tv_nsec += period;
+        while(t.tv_nsec >= 1000000000L){
+            t.tv_nsec -= 1000000000L;
+            ++t.tv_sec;
         }
-        if(r100 > 9998){
-            mesgAddText(&ServerMessages, "O that's good!");
-        }
-        usleep(1000);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+        sendSYNC();
     }
-    LOGERR("stpemulator(): UNREACHABLE CODE REACHED!");
     return NULL;
 }
 
 /**
- * @brief rawcommands - send/receive raw commands
- * @param arg - threadinfo
+ * @brief CANserver - main CAN thread; transmit raw messages by CANbusMessages
+ * @param data - unused
  * @return unused
- * message format: ID [data]; ID - receiver ID (raw), data - 0..8 bytes of data
- * ID == 0 receive everything!
+ * Receiving is made by separate thread CANreceiver, so writing never waits for reading;
+ * all messages queued are sent by one batch; SDO requests are sent through SDO manager
  */
-static void *rawcommands(void *arg){
-    threadinfo *ti = (threadinfo*)arg;
-    while(1){
-        char *mesg = mesgGetText(&ti->commands);
-        if(mesg){
-            DBG("Got raw command: %s", mesg);
-            CANmesg cm;
-            if(!parsePacket(&cm, mesg)) CANBUSPUSH(&cm);
-            FREE(mesg);
+void *CANserver(_U_ void *data){
+    pthread_t rcvthread;
+    if(txevfd < 0 && (txevfd = eventfd(0, EFD_NONBLOCK)) < 0){
+        LOGERR("Can't create eventfd");
+        ERR("eventfd()");
+    }
+    CANbusMessages.evfd = &txevfd;
+    updateCANfilters();
+    reopen_device();
+    if(pthread_create(&rcvthread, NULL, CANreceiver, NULL)){
+        LOGERR("Can't run CANreceiver thread");
+        ERR("pthread_create()");
+    }
+    pthread_detach(rcvthread);
+    if(GP->syncperiod > 0){
+        pthread_t syncthread;
+        if(pthread_create(&syncthread, NULL, SYNCproducer, NULL)){
+            LOGERR("Can't run SYNCproducer thread");
+            ERR("pthread_create()");
         }
-        CANmesg *ans = (CANmesg*) mesgGetObj(&ti->answers, NULL);
-        if(ans){ // got raw answer from bus to thread ID, send it to all
-            char buf[64], *ptr = buf;
-            int l = 64, x;
-            x = snprintf(ptr, l, "#0x%03X ", ans->ID);
-            l -= x; ptr += x;
-            for(int i = 0; i < ans->len; ++i){
-                x = snprintf(ptr, l, "0x%02X ", ans->data[i]);
-                l -= x; ptr += x;
+        pthread_detach(syncthread);
+    }
+    while(1){
+        CANmesg batch[TXBATCH_MAX];
+        int n = 0;
+        double tmout = 0.1; // check connection at least ten times per second
+        while(n < TXBATCH_MAX && CANBUSPOP(&batch[n])) // drain all queued messages
+            if(!sdomgr_push(&batch[n])) ++n;
+        n += sdomgr_poll(batch + n, TXBATCH_MAX - n, &tmout);
+        hb_check(&tmout);
+        if(n){
+            if(canbus_write_batch(batch, n)){
+                LOGWARN("Can't write to CANbus, try to reopen");
+                WARNX("Can't write to canbus");
             }
-            mesgAddText(&ServerMessages, buf);
-            FREE(ans);
-        }
-        usleep(1000);
+        }else mesgWait(txevfd, tmout);
+        if(canbus_disconnected()) reopen_device();
     }
-    LOGERR("rawcommands(): UNREACHABLE CODE REACHED!");
+    LOGERR("CANserver(): UNREACHABLE CODE REACHED!");
     return NULL;
 }
 
+/**
+ * @brief stpemulator_cmd - stepper motor emulator: command
+ * @param ti   - threadinfo
+ * @param mesg - command
+ */
+static void stpemulator_cmd(threadinfo *ti, char *mesg){
+    char buf[MESGTEXT_MAX];
+    DBG("Stepper emulator got: %s", mesg);
+    snprintf(buf, MESGTEXT_MAX, "%s %s", ti->name, mesg);
+    mesgAddText(&ServerMessages, buf);
+    /* do something */
+}
+
+// stepper motor emulator: timer
+static void stpemulator_timer(threadinfo *ti){
+    char buf[128];
+    int r100 = rand() % 10;
+    if(r100 < 1){ // 10% of probability
+        snprintf(buf, 128, "%s stpemulator works fine!", ti->name);
+        mesgAddText(&ServerMessages, buf);
+    }
+    if(r100 > 8){
+        snprintf(buf, 128, "%s O that's good!", ti->name);
+        mesgAddText(&ServerMessages, buf);
+    }
+}
+
+/**
+ * @brief rawcommands_cmd - send raw commands
+ * @param ti   - threadinfo
+ * @param mesg - command
+ * message format: ID [data]; ID - receiver ID (raw), data - 0..8 bytes of data
+ * ID == 0 receive everything!
+ */
+static void rawcommands_cmd(_U_ threadinfo *ti, char *mesg){
+    DBG("Got raw command: %s", mesg);
+    CANmesg cm;
+    if(!parsePacket(&cm, mesg)) CANBUSPUSH(ti, &cm);
+}
+
+// got raw answer from bus to thread ID, send it to all
+static void rawcommands_ans(threadinfo *ti, const CANmesg *ans){
+    char buf[96], *ptr = buf;
+    int l = 96, x;
+    x = snprintf(ptr, l, "%s #0x%03X ", ti->name, ans->ID);
+    l -= x; ptr += x;
+    for(int i = 0; i < ans->len; ++i){
+        x = snprintf(ptr, l, "0x%02X ", ans->data[i]);
+        l -= x; ptr += x;
+    }
+    mesgAddText(&ServerMessages, buf);
+}
+
+/**
+ * @brief SDOdownload - queue segmented SDO download and wake up CANserver
+ * @param ti     - thread
+ * @param NID    - node ID
+ * @param idx    - SDO index
+ * @param subidx - SDO subindex
+ * @param data   - data
+ * @param len    - its length (5..SDO_SEGDATA_MAX)
+ * @return 0 if all OK
+ */
+static int SDOdownload(threadinfo *ti, uint8_t NID, uint16_t idx, uint8_t subidx, const uint8_t *data, size_t len){
+    if(sdomgr_download(NID, idx, subidx, data, len)) return 1;
+    tagRequest(ti, SDOKEY(NID, idx, subidx));
+    eventfd_write(txevfd, 1);
+    return 0;
+}
+
 // make string for CAN message from command message (NodeID index subindex [data] -> ID data)
-static void sendSDO(char *mesg){
-    long info[8] = {0}; // 0 - NodeID, 1 - index, 2 - subindex, 3..6 - data[0..4]
-    int N = 0;
-    char *saveptr = NULL;
-    for(char *s = mesg; N < 8; s = NULL, ++N){
-        char *nxt = strtok_r(s, " \t,;\r\n", &saveptr);
+// more than 4 bytes of data are sent by segmented transfer
+static void sendSDO(threadinfo *ti, char *mesg){
+    long info[3] = {0}; // 0 - NodeID, 1 - index, 2 - subindex
+    uint8_t data[SDO_SEGDATA_MAX];
+    int N = 0, datalen = 0;
+    char *saveptr = NULL, *nxt;
+    for(char *s = mesg; N < 3; s = NULL, ++N){
+        nxt = strtok_r(s, " \t,;\r\n", &saveptr);
         if(!nxt) break;
         if(str2long(nxt, &info[N])) break;
     }
-    if(N > 7 || N < 3){
+    while(N == 3 && (nxt = strtok_r(NULL, " \t,;\r\n", &saveptr))){
+        long l;
+        if(datalen == SDO_SEGDATA_MAX || str2long(nxt, &l)){
+            N = 0;
+            break;
+        }
+        data[datalen++] = (uint8_t) l;
+    }
+    if(N != 3){
         WARNX("Got bad CANopen command");
         LOGMSG("Got bad CANopen command");
         return;
     }
-    DBG("User's message have %d ints", N);
+    DBG("User's message have %d bytes of data", datalen);
+    if(datalen > 4){
+        if(SDOdownload(ti, (uint8_t)info[0], (uint16_t)info[1], (uint8_t)info[2], data, datalen)){
+            char buf[128];
+            snprintf(buf, 128, "%s can't send data to node %ld", ti->name, info[0]);
+            tagmesg(ti->tag, buf);
+        }
+        return;
+    }
 
     CANmesg comesg;
-    uint8_t datalen = (uint8_t) N - 3;
     comesg.data[0] = (datalen) ? SDO_CCS(CCS_INIT_DOWNLOAD) : SDO_CCS(CCS_INIT_UPLOAD); // write or read
     comesg.len = 8;
     if(datalen){ // there's data
         comesg.data[0] |= SDO_N(datalen) | SDO_E | SDO_S;
-        for(int i = 0; i < datalen; ++i) comesg.data[4+i] = (uint8_t)(info[3+i]);
+        for(int i = 0; i < datalen; ++i) comesg.data[4+i] = data[i];
     }
     comesg.data[1] = info[1] & 0xff;
     comesg.data[2] = (info[1] >> 8) & 0xff;
     comesg.data[3] = (uint8_t)(info[2]);
     comesg.ID = (uint16_t)(RSDO_COBID + info[0]);
-    CANBUSPUSH(&comesg);
+    CANBUSPUSH(ti, &comesg);
+}
+
+/**
+ * @brief chkEMCY - send text of emergency message to all
+ * @param ans - message from CAN bus
+ * @param ti  - role instance
+ * @return 1 if it was EMCY, 0 if not
+ */
+static int chkEMCY(const CANmesg *ans, threadinfo *ti){
+    EMCY e;
+    char buf[MESGTEXT_MAX], txt[128];
+    if(!parseEMCY(ans, &e)) return 0;
+    fmtEMCY(&e, txt);
+    snprintf(buf, MESGTEXT_MAX, "%s %s", ti->name, txt);
+    mesgAddText(&ServerMessages, buf);
+    return 1;
 }
 
 // send raw CANopen commands
 // message format: NodeID index subindex [data]
-static void *canopencmds(void *arg){
-    threadinfo *ti = (threadinfo*)arg;
-    while(1){
-        char *mesg = mesgGetText(&ti->commands);
-        if(mesg) do{
-            DBG("Got CANopen command: %s", mesg);
-            sendSDO(mesg);
-            FREE(mesg);
-        }while(0);
-        CANmesg *ans = (CANmesg*)mesgGetObj(&ti->answers, NULL);
-        if(ans){ // got raw answer from bus to thread ID, analize it
-            SDO sdo;
-            if(parseSDO(ans, &sdo)){
-                char buf[128], *ptr = buf;
-                int rest = 128;
-                int l = snprintf(ptr, rest, "%s nid=0x%02X, idx=0x%04X, subidx=%d, ccs=0x%02X, datalen=%d",
-                         ti->name, sdo.NID, sdo.index, sdo.subindex, sdo.ccs, sdo.datalen);
-                ptr += l; rest -= l;
-                if(sdo.datalen){
-                    l = snprintf(ptr, rest, ", data=[");
-                    ptr += l; rest -= l;
-                    for(int idx = 0; idx < sdo.datalen; ++idx){
-                        if(idx) l = snprintf(ptr, rest, ", 0x%02X", sdo.data[idx]);
-                        else l = snprintf(ptr, rest, "0x%02X", sdo.data[idx]);
-                        ptr += l; rest -= l;
-                    }
-                    l = snprintf(ptr, rest, "]");
-                    ptr += l; rest -= l;
-                }
-                mesgAddText(&ServerMessages, buf);
-            }
-            FREE(ans);
+static void canopencmds_cmd(threadinfo *ti, char *mesg){
+    DBG("Got CANopen command: %s", mesg);
+    sendSDO(ti, mesg);
+}
+
+// got raw answer from bus to thread ID, analize it
+static void canopencmds_ans(threadinfo *ti, const CANmesg *ans){
+    SDO sdo;
+    if(chkEMCY(ans, ti)) return;
+    if(!parseSDO(ans, &sdo)) return;
+    char buf[128], *ptr = buf;
+    int rest = 128;
+    int l = snprintf(ptr, rest, "%s nid=0x%02X, idx=0x%04X, subidx=%d, ccs=0x%02X, datalen=%d",
+             ti->name, sdo.NID, sdo.index, sdo.subindex, sdo.ccs, sdo.datalen);
+    ptr += l; rest -= l;
+    if(sdo.datalen){
+        l = snprintf(ptr, rest, ", data=[");
+        ptr += l; rest -= l;
+        for(int idx = 0; idx < sdo.datalen; ++idx){
+            if(idx) l = snprintf(ptr, rest, ", 0x%02X", sdo.data[idx]);
+            else l = snprintf(ptr, rest, "0x%02X", sdo.data[idx]);
+            ptr += l; rest -= l;
         }
-        usleep(1000);
+        l = snprintf(ptr, rest, "]");
+        ptr += l; rest -= l;
     }
-    LOGERR("rawcommands(): UNREACHABLE CODE REACHED!");
-    return NULL;
+    char tag[TAGMAXLEN+1];
+    tagAnswer(ti, SDOKEY(sdo.NID, sdo.index, sdo.subindex), tag);
+    tagmesg(tag, buf);
 }
 
-// check incoming SDO and send data to all (thrname - thread name)
-static void chkSDO(const SDO *sdo, const char *thrname){
-    char buf[128];
-    if(!sdo) return;
+/**
+ * @brief sdostring - print SDO data as string (nonprintable symbols replaced by '?')
+ * @param data  - data
+ * @param len   - its length
+ * @param buf (o) - output buffer
+ * @param bufsz - its size
+ * @return `buf`
+ */
+static char *sdostring(const uint8_t *data, int len, char *buf, int bufsz){
+    int l = 0;
+    for(; l < len && l < bufsz - 1 && data[l]; ++l)
+        buf[l] = (data[l] < ' ' || data[l] > '~' || data[l] == '"') ? '?' : (char)data[l];
+    buf[l] = 0;
+    return buf;
+}
+
+// got data of segmented SDO upload, send it to all as text (if printable) or hex
+static void canopencmds_sdodata(threadinfo *ti, const SDOdata *d){
+    char buf[MESGTEXT_MAX], tag[TAGMAXLEN+1];
+    int printable = 1, l;
+    for(int i = 0; i < d->len; ++i)
+        if((d->data[i] < ' ' || d->data[i] > '~') && !(d->data[i] == 0 && i == d->len - 1)) printable = 0;
+    l = snprintf(buf, MESGTEXT_MAX, "%s nid=0x%02X, idx=0x%04X, subidx=%d, datalen=%d, ",
+             ti->name, d->NID, d->index, d->subindex, d->len);
+    if(printable){
+        char str[SDO_SEGDATA_MAX + 1];
+        snprintf(buf + l, MESGTEXT_MAX - l, "text=\"%s\"", sdostring(d->data, d->len, str, sizeof(str)));
+    }else{
+        l += snprintf(buf + l, MESGTEXT_MAX - l, "hex=");
+        for(int i = 0; i < d->len && l < MESGTEXT_MAX - 3; ++i)
+            l += snprintf(buf + l, MESGTEXT_MAX - l, "%02X", d->data[i]);
+    }
+    tagAnswer(ti, SDOKEY(d->NID, d->index, d->subindex), tag);
+    tagmesg(tag, buf);
+}
+
+/**
+ * @brief fmtSDO - make text of SDO value for clients
+ * @param sdo - SDO (answer or value from PDO)
+ * @param ti  - thread
+ * @param buf (o) - buffer for text (128 bytes)
+ * @return 0 if all OK, 1 if SDO isn't from dictionary
+ */
+static int fmtSDO(const SDO *sdo, threadinfo *ti, char buf[128]){
+    if(!sdo) return 1;
+    const char *thrname = ti->name;
     SDO_dic_entry *de = dictentry_search(sdo->index, sdo->subindex);
-    if(!de) return; // SDO not from dictionary
+    if(!de) return 1; // SDO not from dictionary
     const abortcodes *ac = NULL;
-    int64_t val = getSDOval(sdo, de, &ac);
-    if(val == INT_MAX) // zero-length SDO - last command acknowledgement
+    int64_t val = (de->datasize || sdo->ccs == CCS_ABORT_TRANSFER) ? getSDOval(sdo, de, &ac) : 0;
+    if(!de->datasize && sdo->ccs != CCS_ABORT_TRANSFER){ // short string in expedited transfer
+        char str[5];
+        if(sdo->datalen) snprintf(buf, 128, "%s %s=\"%s\"", thrname, de->varname, sdostring(sdo->data, sdo->datalen, str, 5));
+        else snprintf(buf, 128, "%s %s=OK", thrname, de->varname);
+    }else if(val == INT_MAX) // zero-length SDO - last command acknowledgement
         snprintf(buf, 128, "%s %s=OK", thrname, de->varname);
     else if(val == INT64_MIN) // error
         snprintf(buf, 128, "%s abortcode='0x%X' error='%s'", thrname, ac->code, ac->errmsg);
     else // got value
         snprintf(buf, 128, "%s %s=%" PRId64, thrname, de->varname, val);
-    mesgAddText(&ServerMessages, buf);
+    return 0;
+}
+
+// check incoming SDO and send data to all (with tag of request if any)
+static void chkSDO(const SDO *sdo, threadinfo *ti){
+    char buf[128], tag[TAGMAXLEN+1];
+    if(fmtSDO(sdo, ti, buf)) return;
+    tagAnswer(ti, SDOKEY(sdo->NID, sdo->index, sdo->subindex), tag);
+    tagmesg(tag, buf);
 }
 
 // parser of base stepper motor commands
@@ -390,7 +762,7 @@ static void chkSDO(const SDO *sdo, const char *thrname){
  * @return 0 if found command (or it was erroneous), CMDPAR_ERR_NOTFOUND if not found,
  *      CMDPAR_ERR_SHOWHELP if got 'help', CMDPAR_CLEARERR if got 'stop'
  */
-static int baseStepperCommands(const char *cmd, const threadinfo *ti){
+static int baseStepperCommands(const char *cmd, threadinfo *ti){
     if(!cmd || !ti) return CMDPAR_ERR_NOTFOUND;
     CANmesg can;
     char buf[128];
@@ -407,6 +779,7 @@ static int baseStepperCommands(const char *cmd, const threadinfo *ti){
         [5] = {"setzero", 0, NULL, "set current position as zero"},
         [6] = {"maxspeed", 1, &par, "set/get maxspeed (get: arg==0)"},
         [7] = {"info", 0, NULL, "get motor information"},
+        [8] = {"ident", 0, NULL, "get device name, hardware and software versions"},
         {NULL, 0, NULL, NULL}
     };
     int idx = cmdParser(commands, mesg, ti->name);
@@ -428,22 +801,20 @@ static int baseStepperCommands(const char *cmd, const threadinfo *ti){
                 snprintf(buf, 128, "%s error in command '%s'", ti->name, mesg);
         }
         if(CMDPAR_ERR_SHOWHELP != idx){
-            mesgAddText(&ServerMessages, buf);
+            tagmesg(ti->tag, buf);
             FREE(mesg);
             return 0;
         }
     }
     switch(idx){
-        case 0: // stop
-            CANBUSPUSH(SDO_write(&STOP, NID, 1, &can));
-            CANBUSPUSH(SDO_read(&DEVSTATUS, NID, &can));
-            CANBUSPUSH(SDO_read(&ERRSTATE, NID, &can));
+        case 0: // stop: caller should stop motor and clear errors
+            FREE(mesg);
             return CMDPAR_CLEARERR;
         break;
         case 1: // status, curpos
-            CANBUSPUSH(SDO_read(&DEVSTATUS, NID, &can));
-            CANBUSPUSH(SDO_read(&POSITION, NID, &can));
-            CANBUSPUSH(SDO_read(&ERRSTATE, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&DEVSTATUS, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&POSITION, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&ERRSTATE, NID, &can));
         break;
         case 2: // relmove
             i = 1; // positive direction
@@ -451,38 +822,43 @@ static int baseStepperCommands(const char *cmd, const threadinfo *ti){
                 i = 0; // negative direction
                 par = -par;
             }
-            CANBUSPUSH(SDO_write(&ROTDIR, NID, i, &can));
-            CANBUSPUSH(SDO_write(&RELSTEPS, NID, par, &can));
+            CANBUSPUSH(ti, SDO_write(&ROTDIR, NID, i, &can));
+            CANBUSPUSH(ti, SDO_write(&RELSTEPS, NID, par, &can));
         break;
-        case 3: // absmove
-            CANBUSPUSH(SDO_write(&ABSSTEPS, NID, par, &can));
+        case 3: // absmove (by SDO: RPDO1 is synchronous and used only by `gmove`)
+            CANBUSPUSH(ti, SDO_write(&ABSSTEPS, NID, par, &can));
         break;
         case 4: // enable
             if(par) par = 1;
-            CANBUSPUSH(SDO_write(&ENABLE, NID, par, &can));
+            CANBUSPUSH(ti, SDO_write(&ENABLE, NID, par, &can));
         break;
         case 5: // setzero
-            CANBUSPUSH(SDO_write(&POSITION, NID, 0, &can));
+            CANBUSPUSH(ti, SDO_write(&POSITION, NID, 0, &can));
         break;
         case 6: // maxspeed
             if(par) // set
-                CANBUSPUSH(SDO_write(&MAXSPEED, NID, par, &can));
+                CANBUSPUSH(ti, SDO_write(&MAXSPEED, NID, par, &can));
             else
-                CANBUSPUSH(SDO_read(&MAXSPEED, NID, &can));
+                CANBUSPUSH(ti, SDO_read(&MAXSPEED, NID, &can));
         break;
         case 7: // info
-            CANBUSPUSH(SDO_read(&ERRSTATE, NID, &can));
-            CANBUSPUSH(SDO_read(&DEVSTATUS, NID, &can));
-            CANBUSPUSH(SDO_read(&POSITION, NID, &can));
-            CANBUSPUSH(SDO_read(&ENABLE, NID, &can));
-            CANBUSPUSH(SDO_read(&MICROSTEPS, NID, &can));
-            CANBUSPUSH(SDO_read(&EXTENABLE, NID, &can));
-            CANBUSPUSH(SDO_read(&MAXSPEED, NID, &can));
-            CANBUSPUSH(SDO_read(&MAXCURNT, NID, &can));
-            CANBUSPUSH(SDO_read(&GPIOVAL, NID, &can));
-            CANBUSPUSH(SDO_read(&ROTDIR, NID, &can));
-            CANBUSPUSH(SDO_read(&RELSTEPS, NID, &can));
-            CANBUSPUSH(SDO_read(&ABSSTEPS, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&ERRSTATE, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&DEVSTATUS, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&POSITION, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&ENABLE, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&MICROSTEPS, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&EXTENABLE, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&MAXSPEED, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&MAXCURNT, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&GPIOVAL, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&ROTDIR, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&RELSTEPS, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&ABSSTEPS, NID, &can));
+        break;
+        case 8: // ident
+            CANBUSPUSH(ti, SDO_read(&DEVNAME, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&HWVERSION, NID, &can));
+            CANBUSPUSH(ti, SDO_read(&SWVERSION, NID, &can));
         break;
         default:
         break;
@@ -491,10 +867,121 @@ static int baseStepperCommands(const char *cmd, const threadinfo *ti){
     return 0;
 }
 
+// data of `stepper` role
+typedef struct{
+    coro_sched sched;   // running sequences
+    int64_t pdoval[PDO_MAXMAP]; // last values got by TPDO
+    uint32_t pdogot;    // bits of values got by TPDO at least once
+} simplestp_data;
+
+// objects mapped into TPDO1 (status streaming) and RPDO1 (absolute move of `gmove`, actuated by SYNC) of `stepper`
+static const SDO_dic_entry *stp_tpdo[] = {&POSITION, &DEVSTATUS, &ERRSTATE, &GPIOVAL};
+static const SDO_dic_entry *stp_rpdo[] = {&ABSSTEPS};
+#define STP_TPDO_N      ((int)(sizeof(stp_tpdo) / sizeof(stp_tpdo[0])))
+#define STP_RPDO_N      ((int)(sizeof(stp_rpdo) / sizeof(stp_rpdo[0])))
+// TPDO1 mapping parameters
+static const SDO_dic_entry *tpdomapping[] = {&TPDOM0O1, &TPDOM0O2, &TPDOM0O3, &TPDOM0O4, &TPDOM0O5};
+// TPDO1 inhibit time (x100us) and event timer (ms): from 1 to 10 frames per second
+#define STP_TPDO_INHIBIT    (1000)
+#define STP_TPDO_EVTIMER    (1000)
+
+// write SDO and wait for acknowledgement, `goto fail` if it's absent or abort
+#define coro_write(c, ti, entry, NID, val)  do{ CANmesg wr_; CANBUSPUSH(ti, SDO_write(entry, NID, val, &wr_)); \
+        await_sdo(c, entry, NID); if(!(c)->gotsdo || (c)->sdo.ccs == CCS_ABORT_TRANSFER) goto fail; }while(0)
+
 /**
- * @brief simplestp - simplest stepper motor
- * @param arg - thread identifier
- * @return not used
+ * @brief pdoconf_coro - configure TPDO1 (status streaming) and RPDO1 (absolute move) and start node
+ * @param c  - coroutine
+ * @param ti - role instance
+ * @return CORO_WAIT or CORO_DONE
+ * If node don't accept configuration, PDO aren't used and state is got by SDO polling
+ */
+static int pdoconf_coro(coro *c, threadinfo *ti){
+    CANmesg can;
+    char buf[128];
+    int NID = ti->ID & NODEID_MASK; // node ID
+    CORO_BEGIN(c);
+    // TPDO1: disable, map, event-driven transmission, enable
+    coro_write(c, ti, &TPDOP0CI, NID, PDO_COBID_INVALID | (TPDO1_COBID + NID));
+    coro_write(c, ti, &TPDOM0N, NID, 0);
+    for(c->local[0] = 0; c->local[0] < STP_TPDO_N; ++c->local[0])
+        coro_write(c, ti, tpdomapping[c->local[0]], NID, pdo_mapentry(stp_tpdo[c->local[0]]));
+    coro_write(c, ti, &TPDOM0N, NID, STP_TPDO_N);
+    coro_write(c, ti, &TPDOP0TT, NID, PDO_TT_EVENT);
+    coro_write(c, ti, &TPDOP0IT, NID, STP_TPDO_INHIBIT);
+    coro_write(c, ti, &TPDOP0ET, NID, STP_TPDO_EVTIMER);
+    coro_write(c, ti, &TPDOP0CI, NID, TPDO1_COBID + NID);
+    // RPDO1: the same
+    coro_write(c, ti, &RPDOP0CI, NID, PDO_COBID_INVALID | (RPDO1_COBID + NID));
+    coro_write(c, ti, &RPDOM0N, NID, 0);
+    coro_write(c, ti, &RPDOM0O1, NID, pdo_mapentry(stp_rpdo[0]));
+    coro_write(c, ti, &RPDOM0N, NID, STP_RPDO_N);
+    coro_write(c, ti, &RPDOP0TT, NID, PDO_TT_SYNC);
+    coro_write(c, ti, &RPDOP0CI, NID, RPDO1_COBID + NID);
+    // PDO work only in operational state
+    can.ID = NMT_COBID;
+    can.len = 2;
+    can.data[0] = NMT_START;
+    can.data[1] = NID;
+    CANBUSPUSH(ti, &can);
+    pdo_setmap(NID, PDO_TX, stp_tpdo, STP_TPDO_N);
+    pdo_setmap(NID, PDO_RX, stp_rpdo, STP_RPDO_N);
+    c->local[1] = 1;
+fail:
+    snprintf(buf, 128, "%s pdo=%s", ti->name, c->local[1] ? "on" : "off");
+    tagmesg(ti->tag, buf);
+    CORO_END(c);
+}
+
+/**
+ * @brief clearerr_coro - stop motor and clear errors
+ * @param c  - coroutine
+ * @param ti - role instance
+ * @return CORO_WAIT or CORO_DONE
+ */
+static int clearerr_coro(coro *c, threadinfo *ti){
+    CANmesg can;
+    int NID = ti->ID & NODEID_MASK; // node ID
+    CORO_BEGIN(c);
+    CANBUSPUSH(ti, SDO_write(&STOP, NID, 1, &can));
+    await_sdo(c, &STOP, NID);
+    CANBUSPUSH(ti, SDO_read(&ERRSTATE, NID, &can));
+    await_sdo(c, &ERRSTATE, NID);
+    if(c->gotsdo && c->sdo.ccs != CCS_ABORT_TRANSFER && c->sdo.data[0]){ // clear errors by writing them back
+        CANBUSPUSH(ti, SDO_write(&ERRSTATE, NID, c->sdo.data[0], &can));
+        await_sdo(c, &ERRSTATE, NID);
+    }
+    CANBUSPUSH(ti, SDO_read(&DEVSTATUS, NID, &can));
+    await_sdo(c, &DEVSTATUS, NID);
+    if(c->gotsdo && c->sdo.ccs != CCS_ABORT_TRANSFER && c->sdo.data[0]){
+        CANBUSPUSH(ti, SDO_write(&DEVSTATUS, NID, c->sdo.data[0], &can));
+        await_sdo(c, &DEVSTATUS, NID);
+    }
+    CORO_END(c);
+}
+
+/**
+ * @brief simplestp_config - configure node: max speed, heartbeat, PDO and NMT start
+ * @param ti - role instance
+ * Called at start and after boot-up of node (it loses all configuration); configuration running
+ * at that moment is useless, so it's replaced by new one
+ */
+static void simplestp_config(threadinfo *ti){
+    CANmesg can;
+    simplestp_data *d = (simplestp_data*)ti->roledata;
+    int NID = ti->ID & NODEID_MASK; // node ID
+    CANBUSPUSH(ti, SDO_write(&MAXSPEED, NID, 3200, &can));
+    if(GP->hbperiod > 0){ // node produces heartbeat, we monitor it
+        CANBUSPUSH(ti, SDO_write(&HEARTBTTIME, NID, HB_PRODUCER_TIME(GP->hbperiod), &can));
+        hb_monitor(NID, GP->hbperiod);
+    }
+    for(int i = 0; i < CORO_MAX; ++i)
+        if(d->sched.c[i].fn == pdoconf_coro) memset(&d->sched.c[i], 0, sizeof(coro));
+    coro_start(&d->sched, pdoconf_coro, ti);
+}
+
+/*
+ * simplest stepper motor
  * Commands:
  *      maxspeed x: set maximal speed to x pulses per second
  *      microsteps x: set microstepping to x pulses per step
@@ -502,53 +989,118 @@ static int baseStepperCommands(const char *cmd, const threadinfo *ti){
  *      status: current position & state
  *      stop: stop motor
  */
-static void *simplestp(void *arg){
-    threadinfo *ti = (threadinfo*)arg;
-    CANmesg can;
-    int NID = ti->ID & NODEID_MASK; // node ID
-    uint8_t clearerr = 0;
-    // prepare all
-    CANBUSPUSH(SDO_write(&MAXSPEED, NID, 3200, &can));
-    while(1){
-        char *mesg = mesgGetText(&ti->commands);
-        if(mesg){
-            DBG("Got command: %s", mesg);
-            int b = baseStepperCommands(mesg, ti);
-            if(b){ // not found, 'help' or 'stop'
-                switch(b){
-                    case CMDPAR_ERR_NOTFOUND: // process own commands
-                    break;
-                    case CMDPAR_ERR_SHOWHELP: // show own help
-                    break;
-                    case CMDPAR_CLEARERR:
-                        clearerr = 1;
-                    break;
-                    default:
-                    break;
+// prepare all
+static void simplestp_init(threadinfo *ti){
+    simplestp_data *d = MALLOC(simplestp_data, 1);
+    ti->roledata = d;
+    simplestp_config(ti);
+}
+
+static void simplestp_cmd(threadinfo *ti, char *mesg){
+    simplestp_data *d = (simplestp_data*)ti->roledata;
+    DBG("Got command: %s", mesg);
+    int b = baseStepperCommands(mesg, ti);
+    if(b){ // not found, 'help' or 'stop'
+        switch(b){
+            case CMDPAR_ERR_NOTFOUND: // process own commands
+            break;
+            case CMDPAR_ERR_SHOWHELP: // show own help
+            break;
+            case CMDPAR_CLEARERR:
+                if(coro_start(&d->sched, clearerr_coro, ti)){
+                    char buf[128];
+                    snprintf(buf, 128, "%s too many running commands", ti->name);
+                    tagmesg(ti->tag, buf);
                 }
-            }
+            break;
+            default:
+            break;
         }
-        CANmesg *ans = (CANmesg*)mesgGetObj(&ti->answers, NULL);
-        if(ans) do{
-            SDO sdo;
-            if(!parseSDO(ans, &sdo)) break;
-            chkSDO(&sdo, ti->name);
-            if(clearerr){
-                if(sdo.index == ERRSTATE.index && sdo.subindex == ERRSTATE.subindex){
-                    CANBUSPUSH(SDO_write(&ERRSTATE, NID, sdo.data[0], &can));
-                    --clearerr;
-                }
-                if(sdo.index == DEVSTATUS.index && sdo.subindex == DEVSTATUS.subindex){
-                    CANBUSPUSH(SDO_write(&DEVSTATUS, NID, sdo.data[0], &can));
-                    --clearerr;
-                }
-            }
-            FREE(ans);
-        }while(0);
-        usleep(1000);
     }
-    LOGERR("simplestp(): UNREACHABLE CODE REACHED!");
-    return NULL;
+}
+
+// got TPDO1 with state: send changed values to all (untagged: they aren't answers to requests)
+static void simplestp_pdo(threadinfo *ti, const CANmesg *ans){
+    simplestp_data *d = (simplestp_data*)ti->roledata;
+    char buf[128];
+    SDO v[PDO_MAXMAP];
+    int n = pdo_unpack(ans, v, PDO_MAXMAP);
+    for(int i = 0; i < n; ++i){
+        SDO_dic_entry *de = dictentry_search(v[i].index, v[i].subindex);
+        if(!de) continue;
+        int64_t val = getSDOval(&v[i], de, NULL);
+        if((d->pdogot & (1U << i)) && d->pdoval[i] == val) continue;
+        d->pdoval[i] = val;
+        d->pdogot |= 1U << i;
+        if(!fmtSDO(&v[i], ti, buf)) mesgAddText(&ServerMessages, buf);
+    }
+}
+
+static void simplestp_ans(threadinfo *ti, const CANmesg *ans){
+    simplestp_data *d = (simplestp_data*)ti->roledata;
+    SDO sdo;
+    if((ans->ID & COBID_MASK) == TPDO1_COBID){
+        simplestp_pdo(ti, ans);
+        return;
+    }
+    if((ans->ID & COBID_MASK) == HEARTB_COBID){ // boot-up: node lost configuration, restore it
+        char buf[128];
+        snprintf(buf, 128, "%s reconfigure after boot-up", ti->name);
+        mesgAddText(&ServerMessages, buf);
+        simplestp_config(ti);
+        return;
+    }
+    if(chkEMCY(ans, ti)){ // get actual error state and status
+        CANmesg can;
+        int NID = ti->ID & NODEID_MASK;
+        CANBUSPUSH(ti, SDO_read(&ERRSTATE, NID, &can));
+        CANBUSPUSH(ti, SDO_read(&DEVSTATUS, NID, &can));
+        return;
+    }
+    if(!parseSDO(ans, &sdo)) return;
+    chkSDO(&sdo, ti);
+    coro_sdo(&d->sched, &sdo, ti);
+}
+
+// got data of segmented SDO upload (strings like device name)
+static void simplestp_sdodata(threadinfo *ti, const SDOdata *d){
+    char buf[MESGTEXT_MAX], str[SDO_SEGDATA_MAX + 1], tag[TAGMAXLEN+1];
+    SDO_dic_entry *de = dictentry_search(d->index, d->subindex);
+    if(!de) return; // SDO not from dictionary
+    snprintf(buf, MESGTEXT_MAX, "%s %s=\"%s\"", ti->name, de->varname, sdostring(d->data, d->len, str, sizeof(str)));
+    tagAnswer(ti, SDOKEY(d->NID, d->index, d->subindex), tag);
+    tagmesg(tag, buf);
+}
+
+static void simplestp_timer(threadinfo *ti){
+    simplestp_data *d = (simplestp_data*)ti->roledata;
+    coro_timeouts(&d->sched, ti);
+}
+
+/**
+ * @brief groupMove - synchronous absolute move of several `stepper` axes
+ * @param n   - amount of axes
+ * @param ti  - their role instances
+ * @param pos - target positions
+ * @param buf (o) - buffer for answer
+ * @param bufsz   - its size
+ * @return answer to client (`buf` or constant string)
+ * Targets are preloaded into nodes by synchronous RPDO and released by one SYNC, so all axes start together
+ */
+const char *groupMove(int n, threadinfo **ti, const long *pos, char *buf, size_t bufsz){
+    CANmesg can[GROUPMOVE_MAX];
+    if(n < 1 || n > GROUPMOVE_MAX) return "Wrong amount of axes";
+    for(int i = 0; i < n; ++i){
+        uint8_t NID = ti[i]->ID & NODEID_MASK;
+        if(ti[i]->handler.answer != simplestp_ans || !pdo_pack(NID, &ABSSTEPS, pos[i], &can[i])){
+            snprintf(buf, bufsz, "%s can't move by PDO", ti[i]->name);
+            return buf;
+        }
+    }
+    // all RPDO are queued at once, so periodic SYNC can't get between them and start a part of axes
+    if(!mesgAddObjs(&CANbusMessages, MESG_CAN, can, sizeof(CANmesg), n)) return "Can't send message";
+    if(!GP->syncperiod) sendSYNC(); // else axes will be started by next SYNC
+    return "OK";
 }
 
 /**
@@ -23,10 +23,15 @@
 #include "canbus.h"
 #include "threadlist.h"
 
+// max amount of axes in group move
+#define GROUPMOVE_MAX       (32)
+
 extern thread_handler CANhandlers[];
 
 void *CANserver(void *data);
 thread_handler *get_handler(const char *name);
 void setCANspeed(int speed);
+void updateCANfilters();
+const char *groupMove(int n, threadinfo **ti, const long *pos, char *buf, size_t bufsz);
 
 #endif // PROCESSMOTORS_H__
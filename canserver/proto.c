@@ -18,6 +18,7 @@
 
 #include "aux.h"
 #include "cmdlnopts.h"
+#include "heartbeat.h"
 #include "processmotors.h"
 #include "proto.h"
 #include "socket.h"
@@ -33,6 +34,12 @@ static const char *ANS_WRONGCANID = "Wrong CANID";
 static const char *ANS_NOTFOUND = "Thread not found";
 static const char *ANS_CANTSEND = "Can't send message";
 static const char *ANS_WRONGMESG = "Wrong message";
+static const char *ANS_NOSUBSCR = "Subscription not found";
+
+// subscriptions of client which command is processing now
+static subscriptions *cursubs = NULL;
+// tag of command processing now (empty if none)
+static char curtag[TAGMAXLEN+1] = {0};
 
 static const char *shelp(_U_ char *par1, _U_ char *par2);
 static const char *sthrds(_U_ char *par1, _U_ char *par2);
@@ -40,6 +47,9 @@ static const char *listthr(_U_ char *par1, _U_ char *par2);
 static const char *regthr(char *thrname, char *data);
 static const char *unregthr(char *thrname, char *data);
 static const char *sendmsg(char *thrname, char *data);
+static const char *subscr(char *cls, char *data);
+static const char *unsubscr(char *cls, char *data);
+static const char *gmove(char *thrname, char *data);
 //static const char *setspd(char *speed, _U_ char *data);
 
 /*
@@ -60,12 +70,15 @@ typedef struct{
 // array with known functions
 static cmditem functions[] = {
     {"help", shelp, "- show help"},
+    {"gmove", gmove, "NAME1 POS1 [NAME2 POS2 ...] - absolute move of `stepper` threads started together by one SYNC"},
     {"list", listthr, "- list all threads"},
     {"mesg", sendmsg, "NAME MESG - send message `MESG` to thread `NAME`"},
     {"register", regthr, "NAME ID ROLE - register new thread with `NAME`, raw receiving `ID` running thread `ROLE`"},
 //    {"speed", setspd, "SPD - set CANbus speed to `SPD`"},
+    {"subscribe", subscr, "[CLASS] - receive only messages of `CLASS` (thread name, help, role, thread) and other subscribed; without args - show subscriptions"},
     {"threads", sthrds, "- list all possible threads with their message format"},
     {"unregister", unregthr, "NAME - kill thread `NAME`"},
+    {"unsubscribe", unsubscr, "[CLASS] - unsubscribe from `CLASS` (without args - from all, so receive all messages)"},
     {NULL, NULL, NULL}
 };
 
@@ -99,6 +112,7 @@ static const char *listthr(_U_ char *par1, _U_ char *par2){
     char msg[256];
     threadlist *list = NULL;
     int empty = 1;
+    lockThreadList();
     do{
         list = nextThread(list);
         if(!list) break;
@@ -106,6 +120,7 @@ static const char *listthr(_U_ char *par1, _U_ char *par2){
         mesgAddText(&ServerMessages, msg);
         empty = 0;
     }while(1);
+    unlockThreadList();
     mesgAddText(&ServerMessages, "thread> Send message 'help' to threads marked with (args) to get commands list");
     if(empty) return "No threads";
     return NULL;
@@ -138,6 +153,7 @@ static const char *regthr(char *thrname, char *data){
     thread_handler *h = get_handler(role);
     if(!h) return "Unknown role";
     if(!registerThread(thrname, ID, h)) return "Can't register";
+    updateCANfilters();
     return ANS_OK;
 }
 
@@ -149,7 +165,10 @@ static const char *regthr(char *thrname, char *data){
  */
 static const char *unregthr(char *thrname, _U_ char *data){
     FNAME();
+    threadinfo *ti = findThreadByName(thrname);
+    if(ti && (ti->ID & COBID_MASK) == TSDO_COBID) hb_monitor(ti->ID & NODEID_MASK, 0); // don't monitor node
     if(killThreadByName(thrname)) return ANS_NOTFOUND;
+    updateCANfilters();
     return ANS_OK;
 }
 
@@ -170,9 +189,119 @@ static const char *sendmsg(char *thrname, char *data){
     if(c <= ' ') return ANS_WRONGMESG;
     threadinfo *ti = findThreadByName(thrname);
     if(!ti) return ANS_NOTFOUND;
-    if(!mesgAddText(&ti->commands, data)) return ANS_CANTSEND;
+    if(*curtag){ // pass tag to thread
+        char buf[MESGTEXT_MAX];
+        snprintf(buf, MESGTEXT_MAX, "@%s %s", curtag, data);
+        if(!mesgAddText(&ti->commands, buf)) return ANS_CANTSEND;
+    }else if(!mesgAddText(&ti->commands, data)) return ANS_CANTSEND;
+    return ANS_OK;
+}
+/**
+ * @brief gmove - synchronous absolute move of several axes
+ * @param thrname - name of the first axis
+ * @param data - its position and pairs "NAME POSITION" of other axes
+ * @return answer
+ */
+static const char *gmove(char *thrname, char *data){
+    FNAME();
+    static char buf[128]; // answers are made only by socket thread
+    threadinfo *ti[GROUPMOVE_MAX];
+    long pos[GROUPMOVE_MAX];
+    int n = 0;
+    char *saveptr = NULL, *name = thrname, *p;
+    if(!thrname || !data) return ANS_WRONGMESG;
+    for(char *s = data; name; s = NULL){
+        if(n == GROUPMOVE_MAX) return "Too many axes";
+        p = strtok_r(s, " \t,;\r\n", &saveptr);
+        if(!p || str2long(p, &pos[n])) return ANS_WRONGMESG;
+        if(!(ti[n] = findThreadByName(name))) return ANS_NOTFOUND;
+        ++n;
+        name = strtok_r(NULL, " \t,;\r\n", &saveptr);
+    }
+    return groupMove(n, ti, pos, buf, sizeof(buf));
+}
+
+/**
+ * @brief mesgclass - get class of message: its first word without trailing '>' (after `@tag` if any)
+ * @param mesg - message
+ * @param cls (o) - class
+ */
+void mesgclass(const char *mesg, char cls[THREADNAMEMAXLEN+1]){
+    int l = 0;
+    while(*mesg == ' ' || *mesg == '\t') ++mesg;
+    if(*mesg == '@'){ // skip tag
+        while(*mesg > ' ') ++mesg;
+        while(*mesg == ' ' || *mesg == '\t') ++mesg;
+    }
+    while(l < THREADNAMEMAXLEN && mesg[l] > ' ' && mesg[l] != '>'){
+        cls[l] = mesg[l];
+        ++l;
+    }
+    cls[l] = 0;
+}
+
+/**
+ * @brief subscribed - check if client subscribed to message class
+ * @param subs - client's subscriptions
+ * @param cls  - class of message
+ * @return 1 if client should receive message
+ */
+int subscribed(const subscriptions *subs, const char *cls){
+    if(!subs || subs->n == 0) return 1;
+    for(int i = 0; i < subs->n; ++i)
+        if(0 == strcmp(subs->cls[i], cls)) return 1;
+    return 0;
+}
+
+/**
+ * @brief subscr - subscribe to messages class
+ * @param cls  - class (or NULL to show subscriptions)
+ * @param data - unused
+ * @return answer
+ */
+static const char *subscr(char *cls, _U_ char *data){
+    if(!cursubs) return ANS_CANTSEND;
+    if(!cls){ // show subscriptions
+        static char buf[MAXSUBSCR * (THREADNAMEMAXLEN + 2) + 32];
+        if(!cursubs->n) return "subscribe> all";
+        int l = snprintf(buf, sizeof(buf), "subscribe>");
+        for(int i = 0; i < cursubs->n; ++i)
+            l += snprintf(buf + l, sizeof(buf) - l, " %s", cursubs->cls[i]);
+        return buf;
+    }
+    char c[THREADNAMEMAXLEN+1];
+    mesgclass(cls, c);
+    if(!*c) return ANS_WRONGMESG;
+    for(int i = 0; i < cursubs->n; ++i)
+        if(0 == strcmp(cursubs->cls[i], c)) return ANS_OK;
+    if(cursubs->n == MAXSUBSCR) return "Too many subscriptions";
+    strcpy(cursubs->cls[cursubs->n++], c);
     return ANS_OK;
 }
+
+/**
+ * @brief unsubscr - unsubscribe from messages class
+ * @param cls  - class (or NULL to unsubscribe from all)
+ * @param data - unused
+ * @return answer
+ */
+static const char *unsubscr(char *cls, _U_ char *data){
+    if(!cursubs) return ANS_CANTSEND;
+    if(!cls){
+        cursubs->n = 0;
+        return ANS_OK;
+    }
+    char c[THREADNAMEMAXLEN+1];
+    mesgclass(cls, c);
+    if(!*c) return ANS_WRONGMESG;
+    for(int i = 0; i < cursubs->n; ++i){
+        if(strcmp(cursubs->cls[i], c)) continue;
+        if(i != --cursubs->n) strcpy(cursubs->cls[i], cursubs->cls[cursubs->n]);
+        return ANS_OK;
+    }
+    return ANS_NOSUBSCR;
+}
+
 /*
 static const char *setspd(char *speed, _U_ char *data){
     FNAME();
@@ -184,15 +313,27 @@ static const char *setspd(char *speed, _U_ char *data){
     return ANS_OK;
 }*/
 
+// add current tag to answer
+static const char *tagged(const char *ans){
+    static char buf[MESGTEXT_MAX];
+    if(!ans || !*curtag) return ans;
+    snprintf(buf, MESGTEXT_MAX, "@%s %s", curtag, ans);
+    return buf;
+}
+
 /**
  * @brief processCommand - parse command received by socket
  * @param cmd (io) - text command (after this function its content will be broken!)
+ *      command could be started with request tag `@tag`: it is echoed in answer and
+ *      passed to thread by `mesg`, so thread's answers to this command will have it too
+ * @param subs     - subscriptions of client (could be changed by command)
  * @return NULL or error answer to user
  */
-const char *processCommand(char *cmd){
+const char *processCommand(char *cmd, subscriptions *subs){
     if(!cmd) return NULL;
     char *saveptr = NULL, *fname = NULL, *procname = NULL, *data = NULL;
     DBG("Got %s", cmd);
+    cmd = gettag(cmd, curtag);
     fname = strtok_r(cmd, " \t\r\n", &saveptr);
     DBG("fname: %s", fname);
     if(fname){
@@ -204,8 +345,13 @@ const char *processCommand(char *cmd){
         }
     }else return NULL;
     for(cmditem *item = functions; item->fname; ++item){
-        if(0 == strcasecmp(item->fname, fname)) return item->handler(procname, data);
+        if(0 == strcasecmp(item->fname, fname)){
+            cursubs = subs;
+            const char *ans = item->handler(procname, data);
+            cursubs = NULL;
+            return tagged(ans);
+        }
     }
-    return "Wrong command";
+    return tagged("Wrong command");
 }
 
@@ -20,6 +20,19 @@
 #ifndef PROTO_H__
 #define PROTO_H__
 
-const char *processCommand(char *cmd);
+#include "threadlist.h"
+
+// max amount of subscriptions of one client
+#define MAXSUBSCR   (16)
+
+// client's subscriptions to message classes (thread names, "help", "list" etc)
+typedef struct{
+    int n;                                      // amount of subscriptions (0 - receive all)
+    char cls[MAXSUBSCR][THREADNAMEMAXLEN+1];    // classes
+} subscriptions;
+
+const char *processCommand(char *cmd, subscriptions *subs);
+void mesgclass(const char *mesg, char cls[THREADNAMEMAXLEN+1]);
+int subscribed(const subscriptions *subs, const char *cls);
 
 #endif // PROTO_H__
@@ -0,0 +1,358 @@
+/*
+ * This file is part of the CANserver project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * SDO transactions manager: CANopen server processes only one SDO at a time, so requests
+ * to each node are queued and sent one by one (next after answer to previous); nodes are
+ * served in parallel. Request without answer is repeated SDO_RETRIES times, then manager
+ * finishes it by "SDO protocol timed out" abort sent to role threads like real answer.
+ * Only uploads and writings of values (targets, configuration) are repeated: writing of action
+ * (relative move, stop etc) could be done by node when only its answer was lost, so it times out
+ * at once. Answers coming when nothing is awaited (e.g. after timeout) are dropped.
+ * Segmented transfers are made by manager itself: role threads get only the final result
+ * (SDOdata for upload, usual download answer for download) or abort.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <usefull_macros.h>
+
+#include "sdomanager.h"
+#include "threadlist.h"
+
+// server command specifiers of segments' answers
+#define SCS_UPLOAD_SEGMENT      (0)
+#define SCS_DOWNLOAD_SEGMENT    (1)
+#define SCS_INIT_DOWNLOAD       (3)
+
+// state of transfer in flight
+typedef enum{
+    SEG_NONE,                   // initiation or expedited transfer
+    SEG_UPLOAD,                 // segmented upload
+    SEG_DOWNLOAD                // segmented download
+} segstate;
+
+// request in queue
+typedef struct{
+    CANmesg m;                  // message to send (for segmented download only index & subindex used)
+    uint8_t *data;              // data of segmented download (or NULL)
+    uint16_t len;               // its length
+} sdoreq;
+
+// queue of node, q[head] is in flight if `busy`
+typedef struct{
+    sdoreq q[SDOQUEUE_LEN];     // requests
+    int head;                   // first request
+    int len;                    // amount of requests
+    int busy;                   // ==1 if q[head] is in progress
+    int send;                   // ==1 if `cur` should be sent
+    int lastmsg;                // ==1 if `cur` finishes transfer (abort), no answer awaited
+    CANmesg cur;                // last message of transfer (repeated if there's no answer)
+    int tries;                  // amount of sendings of `cur`
+    int noretry;                // ==1 if request shouldn't be repeated
+    double deadline;            // time to repeat `cur` or give up
+    segstate seg;               // segmented transfer state
+    uint8_t toggle;             // toggle bit of next segment
+    uint16_t pos;               // bytes of download sent and acknowledged
+    uint16_t sent;              // bytes in last download segment
+    SDOdata up;                 // data of segmented upload
+} sdonode;
+
+static sdonode nodes[NODEID_MASK + 1];
+// objects writing of which is an action: their downloads are never repeated
+static const SDO_dic_entry *actions[] = {&RELSTEPS, &STOP, &ERRSTATE, &SYSCONTROL};
+// CANserver (requests, timeouts) and CANreceiver (answers) threads share `nodes`
+static pthread_mutex_t sdomutex = PTHREAD_MUTEX_INITIALIZER;
+
+// make abort answer on request `req` (as if node sent it)
+static void mkabortans(const CANmesg *req, uint32_t code, CANmesg *ans){
+    SDO_abort(req->ID & NODEID_MASK, 0, 0, code, ans);
+    ans->ID = TSDO_COBID | (req->ID & NODEID_MASK);
+    memcpy(&ans->data[1], &req->data[1], 3); // index & subindex
+}
+
+// make abort answer on request `req` and send it to role threads
+static void sdo_abort(const CANmesg *req, uint32_t code){
+    CANmesg ans;
+    mkabortans(req, code, &ans);
+    dispatchToThreads(ans.ID, MESG_CAN, &ans, sizeof(CANmesg));
+}
+
+// is it request of new SDO transfer?
+static int is_request(const CANmesg *mesg){
+    if((mesg->ID & COBID_MASK) != RSDO_COBID || !(mesg->ID & NODEID_MASK) || mesg->len < 4) return 0;
+    int ccs = GET_CCS(mesg->data[0]);
+    return (ccs == CCS_INIT_UPLOAD || ccs == CCS_INIT_DOWNLOAD);
+}
+
+// @return 1 if request can be repeated when there's no answer (uploads and writings of known values)
+static int repeatable(const sdoreq *r){
+    if(GET_CCS(r->m.data[0]) == CCS_INIT_UPLOAD || r->data) return 1;
+    const SDO_dic_entry *e = dictentry_search(r->m.data[1] | (r->m.data[2] << 8), r->m.data[3]);
+    if(!e) return 0; // unknown object
+    for(size_t i = 0; i < sizeof(actions) / sizeof(actions[0]); ++i)
+        if(e == actions[i]) return 0;
+    return 1;
+}
+
+// put request into queue of node, return 0 if all OK
+static int enqueue(sdonode *n, const CANmesg *mesg, const uint8_t *data, uint16_t len){
+    pthread_mutex_lock(&sdomutex);
+    if(n->len == SDOQUEUE_LEN){
+        pthread_mutex_unlock(&sdomutex);
+        LOGWARN("SDO queue of node %d overflowed", mesg->ID & NODEID_MASK);
+        return 1;
+    }
+    sdoreq *r = &n->q[(n->head + n->len++) % SDOQUEUE_LEN];
+    r->m = *mesg;
+    r->data = NULL;
+    r->len = len;
+    if(data){
+        r->data = MALLOC(uint8_t, len);
+        memcpy(r->data, data, len);
+    }
+    pthread_mutex_unlock(&sdomutex);
+    return 0;
+}
+
+/**
+ * @brief sdomgr_push - put outgoing message into node's queue if it's SDO request
+ * @param mesg - message to send
+ * @return 1 if message queued (or rejected by queue overflow), 0 if it should be sent as is
+ */
+int sdomgr_push(const CANmesg *mesg){
+    if(!is_request(mesg)) return 0;
+    if(enqueue(&nodes[mesg->ID & NODEID_MASK], mesg, NULL, 0))
+        sdo_abort(mesg, SDO_ABORT_NOMEM);
+    return 1;
+}
+
+/**
+ * @brief sdomgr_download - queue segmented download (CANserver should be waked up after this call)
+ * @param NID    - node ID
+ * @param idx    - SDO index
+ * @param subidx - SDO subindex
+ * @param data   - data to write
+ * @param len    - its length (5..SDO_SEGDATA_MAX bytes)
+ * @return 0 if all OK
+ */
+int sdomgr_download(uint8_t NID, uint16_t idx, uint8_t subidx, const uint8_t *data, size_t len){
+    if(!data || !NID || NID > NODEID_MASK || len < 5 || len > SDO_SEGDATA_MAX) return 1;
+    CANmesg m;
+    SDO sdo = {.NID = NID, .ccs = CCS_INIT_DOWNLOAD, .index = idx, .subindex = subidx};
+    mkMesg(&sdo, &m);
+    return enqueue(&nodes[NID], &m, data, (uint16_t)len);
+}
+
+// current transfer is over: free its request
+static void finish(sdonode *n){
+    FREE(n->q[n->head].data);
+    n->busy = 0;
+    n->seg = SEG_NONE;
+    n->head = (n->head + 1) % SDOQUEUE_LEN;
+    --n->len;
+}
+
+// set next message of transfer
+static void setcur(sdonode *n, const CANmesg *m){
+    n->cur = *m;
+    n->send = 1;
+    n->tries = 0;
+}
+
+// abort transfer: send abort to node and make abort answer for roles
+static void abort_transfer(sdonode *n, uint32_t code, CANmesg *ans){
+    const CANmesg *req = &n->q[n->head].m;
+    CANmesg m;
+    SDO_abort(req->ID & NODEID_MASK, req->data[1] | (req->data[2] << 8), req->data[3], code, &m);
+    setcur(n, &m);
+    n->lastmsg = 1;
+    mkabortans(req, code, ans);
+}
+
+// make next segment of download
+static void download_segment(sdonode *n){
+    const sdoreq *r = &n->q[n->head];
+    CANmesg m = {.ID = r->m.ID, .len = 8};
+    uint16_t l = r->len - n->pos;
+    if(l > 7) l = 7;
+    m.data[0] = SDO_CCS(CCS_SEG_DOWNLOAD) | (n->toggle ? SDO_T : 0) | SDO_SEG_N(l);
+    if(n->pos + l == r->len) m.data[0] |= SDO_C;
+    memcpy(&m.data[1], r->data + n->pos, l);
+    n->sent = l;
+    setcur(n, &m);
+}
+
+// make upload segment request
+static void upload_segment(sdonode *n){
+    CANmesg m = {.ID = n->q[n->head].m.ID, .len = 8};
+    m.data[0] = SDO_CCS(CCS_SEG_UPLOAD) | (n->toggle ? SDO_T : 0);
+    setcur(n, &m);
+}
+
+/**
+ * @brief sdomgr_answer - check message from CAN bus: continue or finish transfer in flight
+ * @param mesg - received message
+ * @return SDOMGR_WAKE if CANserver should send next message of this node,
+ *      SDOMGR_HIDE if message shouldn't be sent to role threads
+ */
+int sdomgr_answer(const CANmesg *mesg){
+    if((mesg->ID & COBID_MASK) != TSDO_COBID || mesg->len != 8) return 0;
+    int ret = 0, gotdata = 0, gotans = 0;
+    SDOdata data;
+    CANmesg ans;
+    sdonode *n = &nodes[mesg->ID & NODEID_MASK];
+    uint8_t spec = mesg->data[0];
+    int scs = GET_CCS(spec);
+    pthread_mutex_lock(&sdomutex);
+    if(!n->busy || n->lastmsg){ // nothing awaited: late answer
+        ret = SDOMGR_HIDE;
+        goto rtn;
+    }
+    const sdoreq *r = &n->q[n->head];
+    int sameidx = (0 == memcmp(&r->m.data[1], &mesg->data[1], 3)); // same index & subindex
+    if(scs == CCS_ABORT_TRANSFER){ // abort from node: send it to roles as is
+        if(sameidx) finish(n);
+        else ret = SDOMGR_HIDE;
+        goto rtn;
+    }
+    switch(n->seg){
+        case SEG_NONE:
+            ret = SDOMGR_HIDE;
+            if(!sameidx) break; // late answer to previous request
+            if(scs == CCS_INIT_UPLOAD && !(spec & SDO_E)){ // segmented upload
+                n->seg = SEG_UPLOAD;
+                n->toggle = 0;
+                n->up.NID = mesg->ID & NODEID_MASK;
+                n->up.index = mesg->data[1] | (mesg->data[2] << 8);
+                n->up.subindex = mesg->data[3];
+                n->up.len = 0;
+                upload_segment(n);
+            }else if(scs == SCS_INIT_DOWNLOAD && r->data){ // segmented download
+                n->seg = SEG_DOWNLOAD;
+                n->toggle = 0;
+                n->pos = 0;
+                download_segment(n);
+            }else{ // expedited transfer finished
+                ret = 0;
+                finish(n);
+            }
+        break;
+        case SEG_UPLOAD:
+            ret = SDOMGR_HIDE;
+            if(scs != SCS_UPLOAD_SEGMENT){
+                abort_transfer(n, SDO_ABORT_CCS, &ans); gotans = 1;
+            }else if(!!(spec & SDO_T) != n->toggle){
+                abort_transfer(n, SDO_ABORT_TOGGLE, &ans); gotans = 1;
+            }else if(n->up.len + SDO_SEG_datalen(spec) > SDO_SEGDATA_MAX){
+                abort_transfer(n, SDO_ABORT_NOMEM, &ans); gotans = 1;
+            }else{
+                memcpy(n->up.data + n->up.len, &mesg->data[1], SDO_SEG_datalen(spec));
+                n->up.len += SDO_SEG_datalen(spec);
+                n->toggle = !n->toggle;
+                if(spec & SDO_C){ // last segment
+                    data = n->up;
+                    gotdata = 1;
+                    finish(n);
+                }else upload_segment(n);
+            }
+        break;
+        case SEG_DOWNLOAD:
+            ret = SDOMGR_HIDE;
+            if(scs != SCS_DOWNLOAD_SEGMENT){
+                abort_transfer(n, SDO_ABORT_CCS, &ans); gotans = 1;
+            }else if(!!(spec & SDO_T) != n->toggle){
+                abort_transfer(n, SDO_ABORT_TOGGLE, &ans); gotans = 1;
+            }else{
+                n->pos += n->sent;
+                n->toggle = !n->toggle;
+                if(n->pos == r->len){ // done: answer like for expedited download
+                    memset(&ans, 0, sizeof(ans));
+                    ans.ID = mesg->ID;
+                    ans.len = 8;
+                    ans.data[0] = SDO_CCS(SCS_INIT_DOWNLOAD);
+                    memcpy(&ans.data[1], &r->m.data[1], 3);
+                    gotans = 1;
+                    finish(n);
+                }else download_segment(n);
+            }
+        break;
+    }
+rtn:
+    if(n->send || (!n->busy && n->len)) ret |= SDOMGR_WAKE;
+    pthread_mutex_unlock(&sdomutex);
+    if(gotdata) dispatchToThreads(mesg->ID, MESG_SDODATA, &data, sizeof(SDOdata));
+    if(gotans) dispatchToThreads(mesg->ID, MESG_CAN, &ans, sizeof(CANmesg));
+    return ret;
+}
+
+/**
+ * @brief sdomgr_poll - get messages to send now: next requests of idle nodes, segments and repeats
+ * @param tx (o)     - array for messages
+ * @param max        - its size
+ * @param tmout (io) - max time to sleep till next call: decreased to nearest timeout if need
+ * @return amount of messages in `tx`
+ */
+int sdomgr_poll(CANmesg *tx, int max, double *tmout){
+    CANmesg failed[NODEID_MASK + 1];
+    int N = 0, nfailed = 0;
+    double t = dtime();
+    pthread_mutex_lock(&sdomutex);
+    for(int i = 1; i <= NODEID_MASK; ++i){
+        sdonode *n = &nodes[i];
+        if(n->busy && !n->send && t >= n->deadline){
+            if(n->tries > SDO_RETRIES || (n->noretry && n->seg == SEG_NONE)){ // give up
+                const CANmesg *req = &n->q[n->head].m;
+                LOGWARN("SDO 0x%04X/%d to node %d timed out%s", req->data[1] | (req->data[2] << 8), req->data[3], i,
+                        n->noretry ? " (not repeated)" : "");
+                failed[nfailed++] = *req;
+                if(n->seg != SEG_NONE && N < max) // tell node that we don't wait anymore
+                    SDO_abort(i, req->data[1] | (req->data[2] << 8), req->data[3], SDO_ABORT_TIMEOUT, &tx[N++]);
+                finish(n);
+            }else n->send = 1; // repeat
+        }
+        if(!n->busy && n->len){ // start next transfer
+            const sdoreq *r = &n->q[n->head];
+            n->busy = 1;
+            n->lastmsg = 0;
+            n->seg = SEG_NONE;
+            n->noretry = !repeatable(r);
+            if(r->data){ // initiate segmented download: size indicated
+                CANmesg m = r->m;
+                m.data[0] = SDO_CCS(CCS_INIT_DOWNLOAD) | SDO_S;
+                for(int b = 0; b < 4; ++b) m.data[4+b] = (r->len >> (8*b)) & 0xff;
+                setcur(n, &m);
+            }else setcur(n, &r->m);
+        }
+        if(n->send && N < max){
+            tx[N++] = n->cur;
+            n->send = 0;
+            if(n->lastmsg) finish(n); // no answer awaited
+            else{
+                ++n->tries;
+                n->deadline = t + SDO_ANS_TIMEOUT;
+            }
+        }
+        if(n->send || (!n->busy && n->len)) *tmout = 0.; // there's no place in `tx`
+        else if(n->busy && n->deadline - t < *tmout) *tmout = n->deadline - t;
+    }
+    pthread_mutex_unlock(&sdomutex);
+    for(int i = 0; i < nfailed; ++i) sdo_abort(&failed[i], SDO_ABORT_TIMEOUT);
+    if(*tmout < 0.) *tmout = 0.;
+    return N;
+}
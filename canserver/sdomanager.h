@@ -0,0 +1,43 @@
+/*
+ * This file is part of the CANserver project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef SDOMANAGER_H__
+#define SDOMANAGER_H__
+
+#include <stddef.h>
+
+#include "canopen.h"
+
+// max amount of SDO requests waiting in queue of one node
+#define SDOQUEUE_LEN        (32)
+// amount of repeats of SDO request without answer
+#define SDO_RETRIES         (2)
+
+// bits returned by sdomgr_answer
+// CANserver should be waked up to send next request
+#define SDOMGR_WAKE         (1<<0)
+// message is a part of segmented transfer: don't send it to role threads
+#define SDOMGR_HIDE         (1<<1)
+
+int sdomgr_push(const CANmesg *mesg);
+int sdomgr_download(uint8_t NID, uint16_t idx, uint8_t subidx, const uint8_t *data, size_t len);
+int sdomgr_answer(const CANmesg *mesg);
+int sdomgr_poll(CANmesg *tx, int max, double *tmout);
+
+#endif // SDOMANAGER_H__
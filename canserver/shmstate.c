@@ -0,0 +1,136 @@
+/*
+ * This file is part of the CANserver project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// motors' state table in POSIX shared memory, updated by SDO answers from CAN bus
+
+#include <fcntl.h>      // O_xx
+#include <string.h>
+#include <sys/mman.h>   // shm_open, mmap
+#include <sys/time.h>   // gettimeofday
+#include <unistd.h>
+#include <usefull_macros.h>
+
+#include "canopen.h"
+#include "shmstate.h"
+
+static shmstate *state = NULL;
+static char *shmname = NULL;
+
+/**
+ * @brief shmstate_open - create shared memory object with state table
+ * @param name - object name (like "/canserver")
+ * @return 0 if all OK
+ */
+int shmstate_open(const char *name){
+    if(state || !name) return 1;
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if(fd < 0){
+        WARN("shm_open()");
+        return 1;
+    }
+    if(ftruncate(fd, sizeof(shmstate))){
+        WARN("ftruncate()");
+        close(fd);
+        return 1;
+    }
+    state = mmap(NULL, sizeof(shmstate), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(state == MAP_FAILED){
+        WARN("mmap()");
+        state = NULL;
+        return 1;
+    }
+    memset(state, 0, sizeof(shmstate));
+    state->version = SHMSTATE_VERSION;
+    state->nnodes = SHMSTATE_NODES;
+    __atomic_store_n(&state->magic, SHMSTATE_MAGIC, __ATOMIC_RELEASE);
+    shmname = strdup(name);
+    return 0;
+}
+
+// unmap and remove shared memory object
+void shmstate_close(){
+    if(!state) return;
+    munmap(state, sizeof(shmstate));
+    state = NULL;
+    shm_unlink(shmname);
+    FREE(shmname);
+}
+
+// change value of node record under seqlock, set its time of update to current
+static void store(nodestate *n, int32_t *val, double *t, uint32_t bit, int32_t v){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint32_t s = n->seq;
+    __atomic_store_n(&n->seq, s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    *val = v;
+    *t = tv.tv_sec + tv.tv_usec / 1e6;
+    n->valid |= bit;
+    __atomic_store_n(&n->seq, s + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief shmstate_update - store value from SDO answer (if it's one of state values)
+ * @param mesg - message from CAN bus
+ * Should be called by the only thread (CAN receiver)
+ */
+void shmstate_update(const CANmesg *mesg){
+    if(!state || (mesg->ID & COBID_MASK) != TSDO_COBID) return;
+    SDO sdo;
+    if(!parseSDO(mesg, &sdo)) return;
+    shmstate_sdo(&sdo);
+}
+
+/**
+ * @brief shmstate_sdo - store value of object got by SDO upload or PDO
+ * @param sdo - value
+ * Should be called by the only thread (CAN receiver)
+ */
+void shmstate_sdo(const SDO *sdo){
+    if(!state || sdo->ccs != CCS_INIT_UPLOAD || !sdo->datalen) return;
+    const SDO_dic_entry *e;
+    int32_t *val;
+    double *t;
+    uint32_t bit;
+    nodestate *n = &state->node[sdo->NID];
+#define CHK(entry, field, flag) if(sdo->index == entry.index && sdo->subindex == entry.subindex){ \
+        e = &entry; val = &n->field; t = &n->t ## field; bit = flag;}
+    CHK(POSITION, position, SHMST_POSITION)
+    else CHK(ENCPOS, encpos, SHMST_ENCPOS)
+    else CHK(DEVSTATUS, devstatus, SHMST_DEVSTATUS)
+    else CHK(ERRSTATE, errstate, SHMST_ERRSTATE)
+    else CHK(GPIOVAL, gpioval, SHMST_GPIOVAL)
+    else return;
+#undef CHK
+    int64_t v = getSDOval(sdo, e, NULL);
+    if(v == INT64_MIN) return;
+    store(n, val, t, bit, (int32_t)v);
+}
+
+/**
+ * @brief shmstate_nmt - store NMT state of node got by heartbeat
+ * @param NID   - node ID
+ * @param nmt - NMT state
+ * Should be called by the only thread (CAN receiver)
+ */
+void shmstate_nmt(uint8_t NID, int nmt){
+    if(!state || NID >= SHMSTATE_NODES) return;
+    nodestate *n = &state->node[NID];
+    store(n, &n->nmtstate, &n->tnmtstate, SHMST_NMTSTATE, nmt);
+}
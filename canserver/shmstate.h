@@ -0,0 +1,94 @@
+/*
+ * This file is part of the CANserver project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef SHMSTATE_H__
+#define SHMSTATE_H__
+
+#include <stdint.h>
+
+#include "canopen.h"
+
+// "CANS"
+#define SHMSTATE_MAGIC      (0x534E4143)
+#define SHMSTATE_VERSION    (2)
+// one record per CANopen node ID
+#define SHMSTATE_NODES      (128)
+
+// bits of `valid` field: what values were received
+#define SHMST_POSITION      (1<<0)
+#define SHMST_ENCPOS        (1<<1)
+#define SHMST_DEVSTATUS     (1<<2)
+#define SHMST_ERRSTATE      (1<<3)
+#define SHMST_GPIOVAL       (1<<4)
+#define SHMST_NMTSTATE      (1<<5)
+
+/*
+ * State of node: last values of SDO answers (or TPDO), NMT state from heartbeat and time (UNIX time,
+ * seconds) when they were got; node is alive if `theartbeat` is fresh.
+ * Record is protected by seqlock: writer makes `seq` odd before changing and even after it.
+ */
+typedef struct{
+    uint32_t seq;           // seqlock counter
+    uint32_t valid;         // SHMST_xx bits of values received at least once
+    int32_t position;       // POSITION
+    int32_t encpos;         // ENCPOS
+    int32_t devstatus;      // DEVSTATUS
+    int32_t errstate;       // ERRSTATE
+    int32_t gpioval;        // GPIOVAL
+    int32_t nmtstate;       // NMT state from heartbeat
+    double tposition;       // time of last update of each value
+    double tencpos;
+    double tdevstatus;
+    double terrstate;
+    double tgpioval;
+    double tnmtstate;       // time of last heartbeat
+} nodestate;
+
+// shared memory object: header and records of nodes (index is NodeID)
+typedef struct{
+    uint32_t magic;         // SHMSTATE_MAGIC
+    uint32_t version;       // SHMSTATE_VERSION
+    uint32_t nnodes;        // SHMSTATE_NODES
+    uint32_t reserved;
+    nodestate node[SHMSTATE_NODES];
+} shmstate;
+
+/**
+ * @brief shmstate_get - consistent copy of node state (for readers mapped shared memory)
+ * @param st  - shared memory
+ * @param NID - node ID
+ * @param out (o) - state
+ */
+static inline void shmstate_get(const shmstate *st, int NID, nodestate *out){
+    const nodestate *n = &st->node[NID & (SHMSTATE_NODES - 1)];
+    uint32_t s;
+    do{
+        while((s = __atomic_load_n(&n->seq, __ATOMIC_ACQUIRE)) & 1);
+        *out = *n;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }while(__atomic_load_n(&n->seq, __ATOMIC_RELAXED) != s);
+}
+
+int shmstate_open(const char *name);
+void shmstate_close();
+void shmstate_update(const CANmesg *mesg);
+void shmstate_sdo(const SDO *sdo);
+void shmstate_nmt(uint8_t NID, int nmt);
+
+#endif // SHMSTATE_H__
@@ -24,15 +24,18 @@
 #include "term.h"
 
 #include <arpa/inet.h>  // inet_ntop
-#include <sys/ioctl.h>
+#include <errno.h>
+#include <fcntl.h>      // fcntl
 #include <limits.h>     // INT_xxx
 #include <netdb.h>      // addrinfo
-#include <poll.h>
 #include <pthread.h>
 #include <signal.h>     // pthread_kill
 #include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/syscall.h> // syscall
+#include <sys/un.h>     // sockaddr_un
 #include <unistd.h>     // daemon
 #include <usefull_macros.h>
 
@@ -40,137 +43,313 @@
 #define BUFLEN    (1024)
 // Max amount of connections
 #define BACKLOG   (30)
+// size of output buffer of each client: client is disconnected when it overflows
+#define OUTBUFLEN (65536)
+// max amount of epoll events per one call
+#define MAXEVENTS (32)
 
 message ServerMessages = {0};
 
+// connected client
+typedef struct client_{
+    int fd;                     // socket
+    int seqpacket;              // ==1 for local SOCK_SEQPACKET client (each packet is full command[s] or one message)
+    char inbuf[BUFLEN];         // incomplete input line
+    size_t inlen;               // its length
+    char outbuf[OUTBUFLEN];     // data waiting for sending (for `seqpacket` messages are separated by '\0')
+    size_t outstart, outlen;    // start of data in `outbuf` and its length
+    int overflow;               // ==1 if client don't read its data and should be disconnected
+    subscriptions subs;         // classes of broadcast messages client want to receive
+    struct client_ *next;       // next client in list
+} client;
+
+static client *clients = NULL;  // all connected clients
+static int nclients = 0;        // amount of clients
+static int epollfd = -1;
+// listening sockets: TCP and local (AF_UNIX SOCK_SEQPACKET, -1 if none); also used as epoll marks
+static int listenfd[2] = {-1, -1};
+
 /**************** SERVER FUNCTIONS ****************/
-//pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 /**
- * Send data over socket (and add trailing '\n' if absent)
- * @param sock      - socket fd
+ * @brief flush_client - send all possible data from client's output buffer (non-blocking)
+ * @param cl - client
+ * @return 0 if all OK, 1 if client should be disconnected
+ * SOCK_SEQPACKET client gets each message (answer or broadcast) by separate packet
+ */
+static int flush_client(client *cl){
+    while(cl->outlen){
+        const char *start = cl->outbuf + cl->outstart;
+        size_t len = cl->outlen, skip = 0;
+        if(cl->seqpacket){ // one message without its '\0' separator
+            const char *end = memchr(start, 0, len);
+            if(end){
+                len = end - start;
+                skip = 1;
+            }
+        }
+        ssize_t l = send(cl->fd, start, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(l < 0){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            WARN("send()");
+            LOGERR("flush_client(): send() failed");
+            return 1;
+        }
+        if(cl->seqpacket) l = len + skip; // packet is sent entirely
+        cl->outstart += l; cl->outlen -= l;
+    }
+    if(!cl->outlen) cl->outstart = 0;
+    // wait for EPOLLOUT only when there's something to send
+    struct epoll_event ev = {.events = EPOLLIN | (cl->outlen ? EPOLLOUT : 0), .data.ptr = cl};
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, cl->fd, &ev);
+    return 0;
+}
+
+/**
+ * Put data into client's output buffer (and add trailing '\n' if absent)
+ * @param cl        - client
  * @param textbuf   - zero-trailing buffer with data to send
- * @return amount of sent bytes
+ * @return amount of bytes queued
+ * Client which can't read its data is marked to disconnect
  */
-static size_t send_data(int sock, const char *textbuf){
-    ssize_t Len = strlen(textbuf);
-    if(Len != send(sock, textbuf, Len, MSG_NOSIGNAL)){
-        WARN("write()");
-        LOGERR("send_data(): write() failed");
-        return 0;
-    }else LOGDBG("send_data(): sent '%s'", textbuf);
-    if(textbuf[Len-1] != '\n') Len += send(sock, "\n", 1, MSG_NOSIGNAL);
-    return (size_t)Len;
+static size_t send_data(client *cl, const char *textbuf){
+    if(cl->overflow) return 0;
+    size_t Len = strlen(textbuf);
+    if(!Len) return 0;
+    int extra = (textbuf[Len-1] != '\n') + cl->seqpacket; // '\n' and '\0' (end of packet)
+    if(cl->outstart + cl->outlen + Len + extra > OUTBUFLEN){ // move data to buffer's start
+        memmove(cl->outbuf, cl->outbuf + cl->outstart, cl->outlen);
+        cl->outstart = 0;
+        if(cl->outlen + Len + extra > OUTBUFLEN){
+            LOGWARN("Client %d don't read its data, disconnect", cl->fd);
+            WARNX("Output buffer of client %d overflowed", cl->fd);
+            cl->overflow = 1;
+            return 0;
+        }
+    }
+    char *ptr = cl->outbuf + cl->outstart + cl->outlen;
+    memcpy(ptr, textbuf, Len);
+    if(textbuf[Len-1] != '\n') ptr[Len++] = '\n';
+    if(cl->seqpacket) ptr[Len++] = 0;
+    cl->outlen += Len;
+    LOGDBG("send_data(): queued '%s'", textbuf);
+    return Len;
+}
+
+/**
+ * @brief process_line - process one command from client
+ * @param cl   - client
+ * @param line - command (without trailing '\n')
+ */
+static void process_line(client *cl, char *line){
+    // now we should check what do user want
+    // here we can process user data
+    DBG("user %d send '%s'", cl->fd, line);
+    LOGDBG("user %d send '%s'", cl->fd, line);
+    if(GP->echo){
+        send_data(cl, line);
+    }
+    const char *ans = processCommand(line, &cl->subs); // run command parser
+    if(ans){
+        send_data(cl, ans);   // send answer
+    }
 }
 
 /**
- * @brief handle_socket - read and process data from socket
- * @param sock - socket fd
+ * @brief handle_socket - read data from socket and process all full lines
+ * @param cl - client
  * @return 0 if all OK, 1 if socket closed
  */
-static int handle_socket(int sock){
+static int handle_socket(client *cl){
     FNAME();
-    char buff[BUFLEN];
-    ssize_t rd = read(sock, buff, BUFLEN-1);
+    ssize_t rd;
+    struct iovec iov = {.iov_base = cl->inbuf + cl->inlen, .iov_len = BUFLEN - 1 - cl->inlen};
+    struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1};
+    if(cl->seqpacket) rd = recvmsg(cl->fd, &mh, 0); // check if packet was truncated
+    else rd = read(cl->fd, iov.iov_base, iov.iov_len);
     if(rd < 1){
         DBG("read() == %zd", rd);
+        if(rd < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
         return 1;
     }
-    // add trailing zero to be on the safe side
-    buff[rd] = 0;
-    // now we should check what do user want
-    // here we can process user data
-    DBG("user %d send '%s'", sock, buff);
-    LOGDBG("user %d send '%s'", sock, buff);
-    if(GP->echo){
-        send_data(sock, buff);
+    // don't process part of packet; packet without trailing '\n' should have place for it
+    if(cl->seqpacket && ((mh.msg_flags & MSG_TRUNC) || (cl->inbuf[rd-1] != '\n' && (size_t)rd == iov.iov_len))){
+        LOGWARN("Too long packet from client %d", cl->fd);
+        send_data(cl, "Too long packet");
+        return 0;
     }
-    //pthread_mutex_lock(&mutex);
-    const char *ans = processCommand(buff); // run command parser
-    if(ans){
-        send_data(sock, ans);   // send answer
+    cl->inlen += rd;
+    if(cl->seqpacket && cl->inbuf[cl->inlen-1] != '\n')
+        cl->inbuf[cl->inlen++] = '\n'; // packet boundary is the end of command
+    // add trailing zero to be on the safe side
+    cl->inbuf[cl->inlen] = 0;
+    char *line = cl->inbuf, *nl;
+    while((nl = memchr(line, '\n', cl->inlen - (line - cl->inbuf)))){
+        *nl = 0;
+        if(nl > line && nl[-1] == '\r') nl[-1] = 0;
+        if(*line) process_line(cl, line);
+        line = nl + 1;
     }
-    //pthread_mutex_unlock(&mutex);
+    cl->inlen -= line - cl->inbuf;
+    if(cl->inlen == BUFLEN - 1){ // line is too long
+        LOGWARN("Too long line from client %d", cl->fd);
+        send_data(cl, "Too long line");
+        cl->inlen = 0;
+    }else if(cl->inlen && line != cl->inbuf) memmove(cl->inbuf, line, cl->inlen);
     return 0;
 }
 
+// close connection and remove client from list
+static void rmclient(client *cl){
+    DBG("Client with fd %d closed", cl->fd);
+    LOGMSG("Client %d disconnected", cl->fd);
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, cl->fd, NULL);
+    close(cl->fd);
+    client **pp = &clients;
+    while(*pp && *pp != cl) pp = &(*pp)->next;
+    if(*pp) *pp = cl->next;
+    --nclients;
+    FREE(cl);
+}
+
+// accept new connection
+static void addclient(int sock){
+    struct sockaddr_storage their_addr;
+    socklen_t size = sizeof(their_addr);
+    int newsock = accept(sock, (struct sockaddr*)&their_addr, &size);
+    if(newsock <= 0){
+        LOGERR("server(): accept() failed");
+        WARN("accept()");
+        return;
+    }
+    char str[INET_ADDRSTRLEN] = "local";
+    if(their_addr.ss_family == AF_INET)
+        inet_ntop(AF_INET, &((struct sockaddr_in*)&their_addr)->sin_addr, str, INET_ADDRSTRLEN);
+    DBG("Connection from %s, give fd=%d", str, newsock);
+    LOGMSG("Got connection from %s, fd=%d", str, newsock);
+    if(GP->maxclients > 0 && nclients >= GP->maxclients){
+        LOGWARN("Max amount of connections: disconnect %s (%d)", str, newsock);
+        const char *m = "Max amount of connections reached!\n";
+        if(send(newsock, m, strlen(m), MSG_NOSIGNAL | MSG_DONTWAIT) < 0) WARN("send()");
+        WARNX("Limit of connections reached");
+        close(newsock);
+        return;
+    }
+    int flags = fcntl(newsock, F_GETFL);
+    fcntl(newsock, F_SETFL, flags | O_NONBLOCK);
+    client *cl = MALLOC(client, 1);
+    cl->fd = newsock;
+    cl->seqpacket = (their_addr.ss_family == AF_UNIX);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = cl};
+    if(epoll_ctl(epollfd, EPOLL_CTL_ADD, newsock, &ev)){
+        WARN("epoll_ctl()");
+        close(newsock);
+        FREE(cl);
+        return;
+    }
+    cl->next = clients;
+    clients = cl;
+    ++nclients;
+}
+
 // main socket server
-static void *server(void *asock){
+static void *server(_U_ void *data){
     LOGMSG("server(): getpid: %d, tid: %lu",getpid(), syscall(SYS_gettid));
-    int sock = *((int*)asock);
-    if(listen(sock, BACKLOG) == -1){
-        LOGERR("server(): listen() failed");
-        WARN("listen");
+    for(int i = 0; i < 2; ++i){
+        if(listenfd[i] < 0) continue;
+        if(listen(listenfd[i], BACKLOG) == -1){
+            LOGERR("server(): listen() failed");
+            WARN("listen");
+            return NULL;
+        }
+    }
+    static int srvevfd = -1; // signaled when ServerMessages got new data
+    if(epollfd < 0 && (epollfd = epoll_create1(0)) < 0){
+        LOGERR("server(): epoll_create1() failed");
+        WARN("epoll_create1()");
+        return NULL;
+    }
+    if(srvevfd < 0){
+        if((srvevfd = eventfd(0, EFD_NONBLOCK)) < 0){
+            LOGERR("server(): eventfd() failed");
+            WARN("eventfd()");
+            return NULL;
+        }
+        ServerMessages.evfd = &srvevfd;
+    }
+    // server sockets and eventfd are marked by &listenfd[i] and &srvevfd
+    struct epoll_event ev = {.events = EPOLLIN};
+    for(int i = 0; i < 2; ++i){
+        if(listenfd[i] < 0) continue;
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, listenfd[i], NULL); // if thread was restarted
+        ev.data.ptr = &listenfd[i];
+        if(epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd[i], &ev)){
+            WARN("epoll_ctl()");
+            return NULL;
+        }
+    }
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, srvevfd, NULL);
+    ev.data.ptr = &srvevfd;
+    if(epoll_ctl(epollfd, EPOLL_CTL_ADD, srvevfd, &ev)){
+        WARN("epoll_ctl()");
         return NULL;
     }
-    int nfd = 1;
-    // max amount of opened fd (+1 for server socket)
-#define MAX_FDS (11)
-    struct pollfd poll_set[MAX_FDS];
-    memset(poll_set, 0, sizeof(poll_set));
-    poll_set[0].fd = sock;
-    poll_set[0].events = POLLIN;
+    struct epoll_event events[MAXEVENTS];
     while(1){
-        poll(poll_set, nfd, 1); // poll for 1ms
-        for(int fdidx = 0; fdidx < nfd; ++fdidx){ // poll opened FDs
-            if((poll_set[fdidx].revents & POLLIN) == 0) continue;
-            poll_set[fdidx].revents = 0;
-            if(fdidx){ // client
-                int fd = poll_set[fdidx].fd;
-                //int nread = 0;
-                //ioctl(fd, FIONREAD, &nread);
-                if(handle_socket(fd)){ // socket closed - remove it from list
-                    close(fd);
-                    DBG("Client with fd %d closed", fd);
-                    LOGMSG("Client %d disconnected", fd);
-                    // move last to free space
-                    poll_set[fdidx] = poll_set[nfd - 1];
-                    //for(int i = fdidx; i < nfd-1; ++i)
-                    //    poll_set[i] = poll_set[i + 1];
-                    --nfd;
-                }
-            }else{ // server
-                socklen_t size = sizeof(struct sockaddr_in);
-                struct sockaddr_in their_addr;
-                int newsock = accept(sock, (struct sockaddr*)&their_addr, &size);
-                if(newsock <= 0){
-                    LOGERR("server(): accept() failed");
-                    WARN("accept()");
-                    continue;
-                }
-                struct in_addr ipAddr = their_addr.sin_addr;
-                char str[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET, &ipAddr, str, INET_ADDRSTRLEN);
-                DBG("Connection from %s, give fd=%d", str, newsock);
-                LOGMSG("Got connection from %s, fd=%d", str, newsock);
-                if(nfd == MAX_FDS){
-                    LOGWARN("Max amount of connections: disconnect %s (%d)", str, newsock);
-                    send_data(newsock, "Max amount of connections reached!\n");
-                    WARNX("Limit of connections reached");
-                    close(newsock);
-                }else{
-                    memset(&poll_set[nfd], 0, sizeof(struct pollfd));
-                    poll_set[nfd].fd = newsock;
-                    poll_set[nfd].events = POLLIN;
-                    ++nfd;
-                }
+        int n = epoll_wait(epollfd, events, MAXEVENTS, -1);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            LOGERR("server(): epoll_wait() failed");
+            WARN("epoll_wait()");
+            return NULL;
+        }
+        int gotmesg = 0;
+        for(int i = 0; i < n; ++i){
+            void *ptr = events[i].data.ptr;
+            if(ptr == &listenfd[0] || ptr == &listenfd[1]){ // server
+                addclient(*(int*)ptr);
+                continue;
+            }
+            if(ptr == &srvevfd){ // new messages
+                mesgWait(srvevfd, 0.);
+                gotmesg = 1;
+                continue;
+            }
+            client *cl = (client*)ptr;
+            if(events[i].events & (EPOLLERR | EPOLLHUP)){
+                rmclient(cl);
+                continue;
             }
-        } // endfor
-        char *srvmesg = mesgGetText(&ServerMessages); // broadcast messages to all clients
-        if(srvmesg){ // send broadcast message to all clients or throw them to /dev/null
-            for(int fdidx = 1; fdidx < nfd; ++fdidx){
-                send_data(poll_set[fdidx].fd, srvmesg);
+            if((events[i].events & EPOLLIN) && handle_socket(cl)){ // socket closed - remove it from list
+                rmclient(cl);
+                continue;
+            }
+            if(cl->overflow || flush_client(cl)) rmclient(cl);
+        }
+        if(gotmesg){ // send broadcast messages to subscribed clients or throw them to /dev/null
+            char srvmesg[MESGTEXT_MAX], cls[THREADNAMEMAXLEN+1];
+            while(mesgGetTextBuf(&ServerMessages, srvmesg, MESGTEXT_MAX)){ // fill all clients' buffers
+                mesgclass(srvmesg, cls);
+                for(client *cl = clients; cl; cl = cl->next)
+                    if(subscribed(&cl->subs, cls)) send_data(cl, srvmesg);
+            }
+            // and then send all by one call for each client
+            client *cl = clients;
+            while(cl){
+                client *next = cl->next;
+                if(cl->overflow || flush_client(cl)) rmclient(cl);
+                cl = next;
             }
-            FREE(srvmesg);
         }
     }
     LOGERR("server(): UNREACHABLE CODE REACHED!");
 }
 
 // data gathering & socket management
-static void daemon_(int sock){
-    if(sock < 0) return;
+static void daemon_(){
+    if(listenfd[0] < 0) return;
     pthread_t sock_thread, canserver_thread;
-    if(pthread_create(&sock_thread, NULL, server, (void*) &sock) ||
+    if(pthread_create(&sock_thread, NULL, server, NULL) ||
        pthread_create(&canserver_thread, NULL, CANserver, NULL)){
         LOGERR("daemon_(): pthread_create() failed");
         ERR("pthread_create()");
@@ -180,7 +359,7 @@ static void daemon_(int sock){
             WARNX("Sockets thread died");
             LOGERR("Sockets thread died");
             pthread_join(sock_thread, NULL);
-            if(pthread_create(&sock_thread, NULL, server, (void*) &sock)){
+            if(pthread_create(&sock_thread, NULL, server, NULL)){
                 LOGERR("daemon_(): new pthread_create(sock_thread) failed");
                 ERR("pthread_create(sock_thread)");
             }
@@ -206,6 +385,34 @@ static void daemon_(int sock){
     LOGERR("daemon_(): UNREACHABLE CODE REACHED!");
 }
 
+/**
+ * @brief open_unixsock - create local socket for clients on the same host
+ * @param path - socket file name (old file is removed)
+ * @return socket bound or -1 if failed
+ */
+static int open_unixsock(const char *path){
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        WARNX("Too long name of local socket: %s", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if(sock < 0){
+        LOGWARN("open_unixsock(): socket() failed");
+        WARN("socket");
+        return -1;
+    }
+    unlink(path);
+    if(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1){
+        close(sock);
+        LOGERR("open_unixsock(): bind() to %s failed", path);
+        WARN("bind");
+        return -1;
+    }
+    return sock;
+}
+
 /**
  * Run daemon service
  */
@@ -250,7 +457,12 @@ void daemonize(char *port){
         ERRX("failed to bind socket");
     }
     freeaddrinfo(res);
-    daemon_(sock);
+    listenfd[0] = sock;
+    if(GP->unixsock && (listenfd[1] = open_unixsock(GP->unixsock)) < 0){
+        LOGERR("daemonize(): failed to bind local socket %s", GP->unixsock);
+        ERRX("failed to bind local socket");
+    }
+    daemon_();
     close(sock);
     LOGERR("daemonize(): UNREACHABLE CODE REACHED!");
     signals(0);
@@ -0,0 +1,200 @@
+/*
+ * This file is part of the CANserver project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// raw SocketCAN (AF_CAN) interface, e.g. can0 or vcan0
+
+#include <errno.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <usefull_macros.h>
+
+#include "socketcan.h"
+
+static int sock = -1;
+
+/**
+ * @brief sockcan_open - open raw CAN socket on interface `ifname`
+ * @param ifname - interface name
+ * @return 0 if all OK
+ */
+int sockcan_open(const char *ifname){
+    if(!ifname) return 1;
+    sockcan_close();
+    struct ifreq ifr;
+    struct sockaddr_can addr;
+    if(strlen(ifname) >= IFNAMSIZ){
+        WARNX("Too long interface name: %s", ifname);
+        return 1;
+    }
+    if((sock = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0){
+        WARN("socket(PF_CAN)");
+        return 1;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    strcpy(ifr.ifr_name, ifname);
+    if(ioctl(sock, SIOCGIFINDEX, &ifr) < 0){
+        WARN("Can't find CAN interface %s", ifname);
+        sockcan_close();
+        return 1;
+    }
+    int on = 1; // kernel timestamps of received frames
+    if(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)) < 0)
+        WARN("setsockopt(SO_TIMESTAMP)");
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        WARN("bind(%s)", ifname);
+        sockcan_close();
+        return 1;
+    }
+    DBG("Opened SocketCAN interface %s", ifname);
+    return 0;
+}
+
+/**
+ * @brief sockcan_setfilters - set kernel receive filters
+ * @param f - ID/mask pairs
+ * @param n - amount of filters (0 - receive all)
+ * @return 0 if all OK
+ */
+int sockcan_setfilters(const canfilter *f, int n){
+    if(sock < 0) return 1;
+    struct can_filter kf[CANFILTERS_MAX];
+    if(n < 1 || n > CANFILTERS_MAX){ // receive all
+        kf[0].can_id = 0;
+        kf[0].can_mask = 0;
+        n = 1;
+    }else for(int i = 0; i < n; ++i){
+        kf[i].can_id = f[i].ID & CAN_SFF_MASK;
+        kf[i].can_mask = (f[i].mask & CAN_SFF_MASK) | CAN_EFF_FLAG | CAN_RTR_FLAG;
+    }
+    if(setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, kf, n * sizeof(struct can_filter)) < 0){
+        WARN("setsockopt(CAN_RAW_FILTER)");
+        return 1;
+    }
+    return 0;
+}
+
+// @return socket descriptor or -1
+int sockcan_fd(){
+    return sock;
+}
+
+void sockcan_close(){
+    if(sock > -1) close(sock);
+    sock = -1;
+}
+
+/**
+ * @brief sockcan_write - send message to bus
+ * @param mesg - message
+ * @return 0 if all OK, 1 if message not sent, -1 if interface is down
+ * If transmit queue of interface is full (ENOBUFS/EAGAIN), wait till it have free place and send
+ * the same frame again (not more than SOCKCAN_TX_TMOUT), so frames aren't lost by bus load
+ */
+int sockcan_write(const CANmesg *mesg){
+    if(sock < 0 || !mesg || mesg->len > 8) return 1;
+    struct can_frame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = mesg->ID & CAN_SFF_MASK;
+    frame.can_dlc = mesg->len;
+    memcpy(frame.data, mesg->data, mesg->len);
+    double t0 = dtime();
+    while(write(sock, &frame, sizeof(frame)) != sizeof(frame)){
+        if(errno == ENETDOWN || errno == ENODEV || errno == EBADF){
+            WARN("sockcan_write()");
+            return -1;
+        }
+        if(errno != ENOBUFS && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+            WARN("sockcan_write()");
+            return 1;
+        }
+        double rest = SOCKCAN_TX_TMOUT - (dtime() - t0);
+        if(rest <= 0.){
+            WARNX("sockcan_write(): transmit queue is full");
+            return 1;
+        }
+        // CAN socket is writeable even when queue of interface is full, so also wait about frame time
+        struct pollfd pfd = {.fd = sock, .events = POLLOUT};
+        if(poll(&pfd, 1, (int)(rest * 1000.) + 1) < 0 && errno != EINTR){
+            WARN("poll()");
+            return 1;
+        }
+        usleep(SOCKCAN_TX_RETRY_US);
+    }
+    return 0;
+}
+
+/**
+ * @brief sockcan_read - read next standard data frame from bus
+ * @param mesg (o) - received message (timemark is kernel timestamp in ms)
+ * @param tmout    - timeout in seconds
+ * @return 0 if got message, 1 if nothing, -1 if interface is down
+ */
+int sockcan_read(CANmesg *mesg, double tmout){
+    if(sock < 0 || !mesg) return -1;
+    struct pollfd pfd = {.fd = sock, .events = POLLIN};
+    double t0 = dtime();
+    do{
+        int tms = (int)((tmout - (dtime() - t0)) * 1000.);
+        if(tms < 0) tms = 0;
+        int p = poll(&pfd, 1, tms);
+        if(p < 0){
+            if(errno == EINTR) continue;
+            WARN("poll()");
+            return -1;
+        }
+        if(p == 0) return 1;
+        if(pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) return -1;
+        struct can_frame frame;
+        char ctrl[CMSG_SPACE(sizeof(struct timeval))];
+        struct iovec iov = {.iov_base = &frame, .iov_len = sizeof(frame)};
+        struct msghdr msg = {
+            .msg_iov = &iov, .msg_iovlen = 1,
+            .msg_control = ctrl, .msg_controllen = sizeof(ctrl)
+        };
+        ssize_t n = recvmsg(sock, &msg, 0);
+        if(n < 0){
+            if(errno == EINTR || errno == EAGAIN) continue;
+            WARN("recvmsg()");
+            return -1;
+        }
+        if(n != sizeof(frame)) continue;
+        // only standard data frames are used by CANopen
+        if(frame.can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_ERR_FLAG)) continue;
+        struct timeval tv = {0};
+        for(struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)){
+            if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_TIMESTAMP)
+                memcpy(&tv, CMSG_DATA(c), sizeof(tv));
+        }
+        mesg->timemark = (uint32_t)(tv.tv_sec * 1000 + tv.tv_usec / 1000);
+        mesg->ID = frame.can_id & CAN_SFF_MASK;
+        mesg->len = frame.can_dlc > 8 ? 8 : frame.can_dlc;
+        memcpy(mesg->data, frame.data, mesg->len);
+        return 0;
+    }while(dtime() - t0 < tmout);
+    return 1;
+}
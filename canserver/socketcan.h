@@ -0,0 +1,38 @@
+/*
+ * This file is part of the CANserver project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef SOCKETCAN_H__
+#define SOCKETCAN_H__
+
+#include "canbus.h"
+
+// max time to wait for free place in transmit queue of interface (seconds)
+#define SOCKCAN_TX_TMOUT        (0.5)
+// pause between attempts to send frame when transmit queue is full (us): about time of one frame
+#define SOCKCAN_TX_RETRY_US     (200)
+
+// SocketCAN backend of canbus.c
+int sockcan_open(const char *ifname);
+void sockcan_close();
+int sockcan_fd();
+int sockcan_setfilters(const canfilter *f, int n);
+int sockcan_write(const CANmesg *mesg);
+int sockcan_read(CANmesg *mesg, double tmout);
+
+#endif // SOCKETCAN_H__
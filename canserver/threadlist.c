@@ -18,58 +18,127 @@
 
 #include "threadlist.h"
 
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include <usefull_macros.h>
 
 // global thread list
 static threadlist *thelist = NULL;
+// list modification (register/kill) mutex
+static pthread_mutex_t listmutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Direct-indexed table of threads by CAN ID for `dispatchToThreads` (index 0 - thread
+ * receiving all messages). Readers never lock: writer unpublishes slot and waits for
+ * all readers entered before that (two-phase readers' counters), only then frees thread data.
+ */
+static threadinfo *idtable[CANIDS_MAX];
+
+// eventfd of reactor; >= 0 if all roles are processed by the single reactor thread
+static int reactorevfd = -1;
+// reactor's ready queue: instances with new messages (FIFO linked by `readynext`)
+static threadinfo *readyhead = NULL, *readytail = NULL;
+static pthread_mutex_t readymutex = PTHREAD_MUTEX_INITIALIZER;
+static int rcu_readers[2] = {0};
+static int rcu_phase = 0;
+
+// wait while all readers of `idtable` started before this call finished their work
+static void synchronize_dispatch(){
+    for(int i = 0; i < 2; ++i){
+        int ph = __atomic_load_n(&rcu_phase, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&rcu_phase, !ph, __ATOMIC_SEQ_CST);
+        while(__atomic_load_n(&rcu_readers[ph], __ATOMIC_SEQ_CST)) usleep(10);
+    }
+}
 
 /**
- * push data into the tail of a list (FIFO)
- * @param lst (io) - list
- * @param v (i)    - data to push
- * @return pointer to just pushed node
+ * @brief dispatchToThreads - send message to `answers` of thread with given ID and thread with ID=0
+ * @param ID   - CAN ID
+ * @param type - type of message
+ * @param data - message
+ * @param size - its size
+ * @return 1 if there's thread with given ID (not 0), 0 if not
+ * Lock-free (except `answers` queue itself), O(1)
  */
-static msglist *pushmessage(msglist **lst, void *v, size_t size){
-    if(!lst || !v) return NULL;
-    msglist *node;
-    if((node = MALLOC(msglist, 1)) == 0)
-        return NULL; // allocation error
-    node->data = malloc(size);
-    if(!node->data){
-        FREE(node);
-        return NULL;
+int dispatchToThreads(int ID, mesgtype type, void *data, size_t size){
+    int ret = 0;
+    if(ID < 0 || ID >= CANIDS_MAX) return 0;
+    int ph = __atomic_load_n(&rcu_phase, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&rcu_readers[ph], 1, __ATOMIC_SEQ_CST);
+    threadinfo *ti = __atomic_load_n(&idtable[0], __ATOMIC_SEQ_CST);
+    if(ti) mesgAddObj(&ti->answers, type, data, size);
+    if(ID && (ti = __atomic_load_n(&idtable[ID], __ATOMIC_SEQ_CST))){
+        mesgAddObj(&ti->answers, type, data, size);
+        ret = 1;
     }
-    memcpy(node->data, v, size);
-    node->size = size;
-    if(!*lst){
-        *lst = node;
-        (*lst)->last = node;
-        return node;
+    __atomic_sub_fetch(&rcu_readers[ph], 1, __ATOMIC_SEQ_CST);
+    return ret;
+}
+
+// record header (size and type) size and marker of ring buffer wrapping (instead of size)
+#define MESG_HDRSZ      (2 * sizeof(uint32_t))
+#define MESG_WRAP       (0xffffffffU)
+// full record length for data of `size` bytes
+#define MESG_RECLEN(size) ((uint32_t)(MESG_HDRSZ + (((size) + 3) & ~(size_t)3)))
+
+/**
+ * push data into the tail of ring buffer (FIFO); producers' mutex should be locked
+ * @param msg (io) - FIFO
+ * @param type     - type of record
+ * @param v (i)    - data to push
+ * @param size     - its size
+ * @return 0 if all OK or 1 if no free space
+ */
+static int pushmessage(message *msg, mesgtype type, const void *v, size_t size){
+    if(size > MESGBUF_SZ / 2) return 1;
+    uint32_t len = MESG_RECLEN(size);
+    uint32_t tail = msg->tail;
+    uint32_t head = __atomic_load_n(&msg->head, __ATOMIC_ACQUIRE);
+    uint32_t idx = tail & (MESGBUF_SZ - 1), skip = 0;
+    if(idx + len > MESGBUF_SZ) skip = MESGBUF_SZ - idx; // no place till the end of buffer
+    if(MESGBUF_SZ - (tail - head) < skip + len) return 1;
+    if(skip){
+        *(uint32_t*)&msg->buf[idx] = MESG_WRAP;
+        idx = 0;
     }
-    (*lst)->last->next = node;
-    (*lst)->last = node;
-    return node;
+    *(uint32_t*)&msg->buf[idx] = (uint32_t)size;
+    *(uint32_t*)&msg->buf[idx + sizeof(uint32_t)] = (uint32_t)type;
+    memcpy(&msg->buf[idx + MESG_HDRSZ], v, size);
+    __atomic_store_n(&msg->tail, tail + skip + len, __ATOMIC_RELEASE);
+    return 0;
 }
 
 /**
- * @brief popmessage - get data from head of list
- * @param lst (io) - list
- * @param size (o) - data size
- * @return data from first node or NULL if absent  (SHOULD BE FREEd AFER USAGE!)
+ * @brief peekmessage - find first record in FIFO (only for consumer)
+ * @param msg (io) - FIFO
+ * @param type (o) - type of record
+ * @param data (o) - pointer to record's data
+ * @return data size or 0 if FIFO is empty
  */
-static void *popmessage(msglist **lst, size_t *size){
-    if(!lst || !*lst) return NULL;
-    char *ret;
-    msglist *node = *lst;
-    if(node->next) node->next->last = node->last; // pop not last message
-    ret = node->data;
-    if(size) *size = node->size;
-    *lst = node->next;
-    FREE(node);
-    return ret;
+static uint32_t peekmessage(message *msg, mesgtype *type, const uint8_t **data){
+    uint32_t head = msg->head;
+    uint32_t tail = __atomic_load_n(&msg->tail, __ATOMIC_ACQUIRE);
+    if(head == tail) return 0;
+    uint32_t idx = head & (MESGBUF_SZ - 1);
+    uint32_t size = *(uint32_t*)&msg->buf[idx];
+    if(size == MESG_WRAP){ // skip till the beginning
+        head += MESGBUF_SZ - idx;
+        __atomic_store_n(&msg->head, head, __ATOMIC_RELEASE);
+        idx = 0;
+        size = *(uint32_t*)&msg->buf[0];
+    }
+    *type = (mesgtype)*(uint32_t*)&msg->buf[idx + sizeof(uint32_t)];
+    *data = &msg->buf[idx + MESG_HDRSZ];
+    return size;
+}
+
+// remove first record with data of `size` bytes (after `peekmessage`)
+static void dropmessage(message *msg, uint32_t size){
+    __atomic_store_n(&msg->head, msg->head + MESG_RECLEN(size), __ATOMIC_RELEASE);
 }
 
 /**
@@ -118,24 +187,116 @@ threadinfo *findThreadByID(int ID){
     return NULL;
 }
 
+// put instance into reactor's ready queue (if it isn't there yet)
+static void readypush(threadinfo *ti){
+    pthread_mutex_lock(&readymutex);
+    if(!ti->inready){
+        ti->inready = 1;
+        ti->readynext = NULL;
+        if(readytail) readytail->readynext = ti;
+        else readyhead = ti;
+        readytail = ti;
+    }
+    pthread_mutex_unlock(&readymutex);
+}
+
+// get first instance from reactor's ready queue, @return NULL if empty
+static threadinfo *readypop(){
+    pthread_mutex_lock(&readymutex);
+    threadinfo *ti = readyhead;
+    if(ti){
+        readyhead = ti->readynext;
+        if(!readyhead) readytail = NULL;
+        ti->inready = 0;
+    }
+    pthread_mutex_unlock(&readymutex);
+    return ti;
+}
+
+// remove killed instance from reactor's ready queue
+static void readyremove(threadinfo *ti){
+    pthread_mutex_lock(&readymutex);
+    if(ti->inready){
+        threadinfo *p = NULL, *t = readyhead;
+        for(; t && t != ti; t = t->readynext) p = t;
+        if(t){
+            if(p) p->readynext = t->readynext;
+            else readyhead = t->readynext;
+            if(readytail == t) readytail = p;
+        }
+        ti->inready = 0;
+    }
+    pthread_mutex_unlock(&readymutex);
+}
+
 /**
- * @brief mesgAddObj - add any object to message
+ * @brief mesgAddObjs - add several objects of the same size to message at once
  * @param msg  (i) - message
- * @param data (i) - any data
- * @param size     - it's size
- * @return pointer to message data if success (NULL if failed)
+ * @param type     - type of objects
+ * @param data (i) - array of `n` objects
+ * @param size     - size of each object
+ * @param n        - amount of objects
+ * @return `data` if success (NULL if failed: nothing added)
+ * Objects are added under one lock, so other producers can't put anything between them
  */
-void *mesgAddObj(message *msg, void *data, size_t size){
-    if(!msg || !data || size == 0) return NULL;
-    //DBG("Want to add mesg with length %zd", size);
+void *mesgAddObjs(message *msg, mesgtype type, void *data, size_t size, int n){
+    if(!msg || !data || size == 0 || n < 1 || size > MESGBUF_SZ / 2) return NULL;
     if(pthread_mutex_lock(&msg->mutex)) return NULL;
-    msglist *node = pushmessage(&msg->msg, data, size);
-    if(!node){
-        pthread_mutex_unlock(&msg->mutex);
-        return NULL;
+    // wrapping skips less than one record, so (n+1) records of free space are enough for all
+    uint32_t avail = MESGBUF_SZ - (msg->tail - __atomic_load_n(&msg->head, __ATOMIC_ACQUIRE));
+    int r = (n > 1 && avail < (uint64_t)MESG_RECLEN(size) * (n + 1));
+    for(int i = 0; i < n && !r; ++i) r = pushmessage(msg, type, (const uint8_t*)data + i * size, size);
+    // report first drop at once and total amount of dropped when queue is free again
+    uint32_t dropped = 0;
+    if(r) dropped = (msg->dropped += n);
+    else if(msg->dropped){
+        dropped = msg->dropped;
+        msg->dropped = 0;
     }
     pthread_mutex_unlock(&msg->mutex);
-    return node->data;
+    if(r){
+        if(dropped == (uint32_t)n){
+            WARNX("Message queue overflow");
+            LOGWARN("Message queue overflow, messages are dropped");
+        }
+        return NULL;
+    }
+    if(dropped) LOGWARN("Message queue overflow: %u messages dropped", dropped);
+    if(msg->owner) readypush(msg->owner);
+    if(msg->evfd){ // wake up consumer
+        uint64_t one = 1;
+        if(sizeof(one) != write(*msg->evfd, &one, sizeof(one))) WARN("write(eventfd)");
+    }
+    return data;
+}
+
+/**
+ * @brief mesgAddObj - add any object to message
+ * @param msg  (i) - message
+ * @param type     - type of object
+ * @param data (i) - any data
+ * @param size     - it's size
+ * @return `data` if success (NULL if failed)
+ */
+void *mesgAddObj(message *msg, mesgtype type, void *data, size_t size){
+    return mesgAddObjs(msg, type, data, size, 1);
+}
+
+/**
+ * @brief mesgWait - wait for new messages in queues signaling `evfd`
+ * @param evfd  - eventfd (`evfd` field of `message`)
+ * @param tmout - timeout in seconds (<0 - wait forever)
+ * @return 1 if there was signal, 0 if timeout or error
+ * After return consumer should process all data from its queues: new signal arrives
+ * only when new message added.
+ */
+int mesgWait(int evfd, double tmout){
+    struct pollfd pfd = {.fd = evfd, .events = POLLIN};
+    int ms = (tmout < 0.) ? -1 : (int)(tmout * 1000.);
+    if(poll(&pfd, 1, ms) < 1) return 0;
+    uint64_t cnt;
+    if(sizeof(cnt) != read(evfd, &cnt, sizeof(cnt))) return 0;
+    return 1;
 }
 
 /**
@@ -148,31 +309,245 @@ char *mesgAddText(message *msg, char *txt){
     if(!txt) return NULL;
     //DBG("mesgAddText(%s)", txt);
     size_t l = strlen(txt) + 1;
-    return mesgAddObj(msg, (void*)txt, l);
+    return mesgAddObj(msg, MESG_TEXT, (void*)txt, l);
 }
 
 /**
- * @brief mesgGetObj - get object from message
- * @param msg (i)  - message
- * @param size (o) - object's size or NULL
- * @return pointer to object or NULL if absent
+ * @brief mesgGetBuf - get object from message into user buffer (without allocation)
+ * @param msg (i) - message
+ * @param type (o) - type of object (or NULL)
+ * @param buf (o) - buffer for object
+ * @param bufsz   - its size (larger objects are truncated)
+ * @return amount of bytes copied or 0 if message is empty
  */
-void *mesgGetObj(message *msg, size_t *size){
-    if(!msg) return NULL;
-    char *text = NULL;
-    if(pthread_mutex_lock(&msg->mutex)) return NULL;
-    text = popmessage(&msg->msg, size);
-    pthread_mutex_unlock(&msg->mutex);
-    return text;
+size_t mesgGetBuf(message *msg, mesgtype *type, void *buf, size_t bufsz){
+    if(!msg || !buf || !bufsz) return 0;
+    const uint8_t *data;
+    mesgtype t;
+    uint32_t size = peekmessage(msg, &t, &data);
+    if(!size) return 0;
+    if(type) *type = t;
+    size_t l = (size > bufsz) ? bufsz : size;
+    memcpy(buf, data, l);
+    dropmessage(msg, size);
+    return l;
 }
 
 /**
- * @brief mesgGetText - get first message from queue (allocates data, should be free'd after usage!)
- * @param msg - message itself
- * @return data or NULL if empty
+ * @brief mesgGetTextBuf - get text message into user buffer
+ * @param msg (i) - message
+ * @param buf (o) - buffer for text
+ * @param bufsz   - its size
+ * @return `buf` or NULL if message is empty
  */
-char *mesgGetText(message *msg){
-    return (char*) mesgGetObj(msg, NULL);
+char *mesgGetTextBuf(message *msg, char *buf, size_t bufsz){
+    size_t l = mesgGetBuf(msg, NULL, buf, bufsz);
+    if(!l) return NULL;
+    buf[(l < bufsz) ? l : bufsz - 1] = 0;
+    return buf;
+}
+
+/**
+ * @brief gettag - get request tag: first word of string started with '@'
+ * @param str     - string like "@tag command"
+ * @param tag (o) - tag without '@' (empty string if none; truncated to TAGMAXLEN)
+ * @return pointer to rest of `str` (after tag and spaces)
+ */
+char *gettag(char *str, char tag[TAGMAXLEN+1]){
+    int l = 0;
+    *tag = 0;
+    if(!str) return NULL;
+    while(*str == ' ' || *str == '\t') ++str;
+    if(*str != '@') return str;
+    ++str;
+    while(*str > ' '){
+        if(l < TAGMAXLEN) tag[l++] = *str;
+        ++str;
+    }
+    tag[l] = 0;
+    while(*str == ' ' || *str == '\t') ++str;
+    return str;
+}
+
+/**
+ * @brief tagRequest - remember tag of command processing now for request with given key
+ * @param ti  - thread
+ * @param key - request key (should be the same for answer)
+ * Requests without tag (e.g. sent by role itself) are remembered too: their answers shouldn't
+ * take tags of client's requests with the same key. Should be called only by thread `ti` itself.
+ */
+void tagRequest(threadinfo *ti, uint32_t key){
+    if(!ti) return;
+    double t = dtime();
+    reqtag *r = NULL;
+    for(int i = 0; i < REQTAGS_MAX; ++i){
+        reqtag *x = &ti->reqtags[i];
+        if(x->t == 0. || t - x->t > REQTAG_TMOUT){ r = x; break; } // free or stale
+        // replace the oldest (untagged at first) if no free slots
+        if(!r || (*r->tag && !*x->tag) || (!*r->tag == !*x->tag && x->seq - r->seq > UINT32_MAX / 2)) r = x;
+    }
+    r->key = key;
+    r->t = t;
+    r->seq = ++ti->reqseq;
+    strcpy(r->tag, ti->tag);
+}
+
+/**
+ * @brief tagAnswer - find and forget the oldest request with given key
+ * @param ti      - thread
+ * @param key     - request key
+ * @param tag (o) - its tag (empty string if not found or request have no tag)
+ * @return 1 if found tagged request
+ */
+int tagAnswer(threadinfo *ti, uint32_t key, char tag[TAGMAXLEN+1]){
+    *tag = 0;
+    if(!ti) return 0;
+    double t = dtime();
+    reqtag *r = NULL;
+    for(int i = 0; i < REQTAGS_MAX; ++i){
+        reqtag *x = &ti->reqtags[i];
+        if(x->t == 0. || x->key != key) continue;
+        if(t - x->t > REQTAG_TMOUT){ x->t = 0.; continue; }
+        if(!r || x->seq - r->seq > UINT32_MAX / 2) r = x; // older (with wrapping of counter)
+    }
+    if(!r) return 0;
+    strcpy(tag, r->tag);
+    r->t = 0.;
+    return (*tag) ? 1 : 0;
+}
+
+/**
+ * @brief roleStep - process all data in thread's queues and call timer if need
+ * @param ti - thread
+ * @return time till next timer call
+ */
+static double roleStep(threadinfo *ti){
+    char cmd[MESGTEXT_MAX];
+    union{
+        CANmesg can;
+        SDOdata sdo;
+    } ans;
+    mesgtype type;
+    thread_handler *h = &ti->handler;
+    while(mesgGetTextBuf(&ti->commands, cmd, MESGTEXT_MAX)){
+        DBG("%s got command: %s", ti->name, cmd);
+        char *c = gettag(cmd, ti->tag); // requests sent by command will be tagged
+        if(h->command) h->command(ti, c);
+        *ti->tag = 0;
+    }
+    while(mesgGetBuf(&ti->answers, &type, &ans, sizeof(ans))){
+        switch(type){
+            case MESG_CAN:
+                if(h->answer) h->answer(ti, &ans.can);
+            break;
+            case MESG_SDODATA:
+                if(h->sdodata) h->sdodata(ti, &ans.sdo);
+            break;
+            default:
+                WARNX("%s: unexpected message of type %d", ti->name, type);
+            break;
+        }
+    }
+    double t = dtime();
+    if(t >= ti->nexttimer){ // callbacks can decrease `nexttimer` if need
+        ti->nexttimer = t + ROLE_TIMER_PERIOD;
+        if(h->timer) h->timer(ti);
+    }
+    t = ti->nexttimer - dtime();
+    return (t > 0.) ? t : 0.;
+}
+
+/**
+ * @brief roleThread - own thread of role instance
+ * @param arg - threadinfo
+ * @return unused
+ */
+static void *roleThread(void *arg){
+    threadinfo *ti = (threadinfo*)arg;
+    while(!__atomic_load_n(&ti->stop, __ATOMIC_ACQUIRE)){
+        double tmout = roleStep(ti);
+        if(__atomic_load_n(&ti->stop, __ATOMIC_ACQUIRE)) break;
+        mesgWait(ti->evfd, ti->handler.timer ? tmout : -1.); // sleep until new command or answer
+    }
+    DBG("Thread '%s' stopped", ti->name);
+    return NULL;
+}
+
+// instances processed by reactor now (pinned under `listmutex`, processed without it)
+static threadinfo **pinned = NULL;
+static int pinnedsz = 0;
+
+// pin instance and add it to `pinned` array of `n` elements; listmutex should be locked
+static void pin(threadinfo *ti, int *n){
+    if(*n == pinnedsz){
+        pinnedsz += 64;
+        pinned = realloc(pinned, pinnedsz * sizeof(threadinfo*));
+        if(!pinned) ERR("realloc()");
+    }
+    __atomic_add_fetch(&ti->pins, 1, __ATOMIC_ACQ_REL);
+    pinned[(*n)++] = ti;
+}
+
+/**
+ * @brief reactor - process all role instances in one thread
+ * @param arg - unused
+ * @return unused
+ * Instances with new messages are taken from ready queue, so message costs O(1);
+ * all instances are walked only when the earliest timer expired
+ */
+static void *reactor(_U_ void *arg){
+    double tmout = ROLE_TIMER_PERIOD, nexttimer = dtime() + ROLE_TIMER_PERIOD; // earliest timer
+    while(1){
+        mesgWait(reactorevfd, tmout);
+        // take instances under lock and process them without it: callbacks can use thread list
+        pthread_mutex_lock(&listmutex);
+        double t = dtime();
+        threadinfo *ti;
+        int n = 0;
+        if(t >= nexttimer){ // process all instances
+            while(readypop());
+            nexttimer = t + ROLE_TIMER_PERIOD;
+            for(threadlist *l = thelist; l; l = l->next) pin(&l->ti, &n);
+        }else while((ti = readypop())) pin(ti, &n); // only instances with new messages
+        pthread_mutex_unlock(&listmutex);
+        for(int i = 0; i < n; ++i){
+            ti = pinned[i];
+            roleStep(ti);
+            if(ti->handler.timer && ti->nexttimer < nexttimer) nexttimer = ti->nexttimer;
+            __atomic_sub_fetch(&ti->pins, 1, __ATOMIC_ACQ_REL);
+        }
+        tmout = nexttimer - dtime();
+        if(tmout < 0.) tmout = 0.;
+    }
+    LOGERR("reactor(): UNREACHABLE CODE REACHED!");
+    return NULL;
+}
+
+/**
+ * @brief startReactor - run all role instances in single reactor thread instead of own threads
+ * @return 0 if all OK
+ * Should be called before any thread registered
+ */
+int startReactor(){
+    if(reactorevfd > -1) return 0;
+    if(thelist){
+        WARNX("startReactor(): there are registered threads");
+        return 1;
+    }
+    pthread_t thr;
+    if((reactorevfd = eventfd(0, EFD_NONBLOCK)) < 0){
+        WARN("eventfd()");
+        return 1;
+    }
+    if(pthread_create(&thr, NULL, reactor, NULL)){
+        WARN("pthread_create()");
+        close(reactorevfd);
+        reactorevfd = -1;
+        return 1;
+    }
+    pthread_detach(thr);
+    LOGMSG("Role instances are processed by single reactor thread");
+    return 0;
 }
 
 /**
@@ -184,25 +559,32 @@ char *mesgGetText(message *msg){
  */
 threadinfo *registerThread(char *name, int ID, thread_handler *handler){
     if(!name || strlen(name) < 1 || !handler) return NULL;
+    if(ID < 0){
+        WARNX("Wrong thread ID: %d", ID);
+        return NULL;
+    }
+    pthread_mutex_lock(&listmutex);
     threadinfo *ti = findThreadByName(name);
     DBG("Register new thread with name '%s' and ID=%d", name, ID);
     if(ti){
         WARNX("Thread named '%s' exists!", name);
+        pthread_mutex_unlock(&listmutex);
         return NULL;
     }
     ti = findThreadByID(ID);
     if(ti){
         WARNX("Thread with ID=%d exists!", ID);
+        pthread_mutex_unlock(&listmutex);
         return NULL;
     }
-    if(!thelist){ // the first element
-        thelist = MALLOC(threadlist, 1);
-        ti = &thelist->ti;
-    }else{
-        threadlist *last = getlast();
-        last->next = MALLOC(threadlist, 1);
-        ti = &last->next->ti;
+    int evfd = (reactorevfd < 0) ? eventfd(0, EFD_NONBLOCK) : reactorevfd;
+    if(evfd < 0){
+        WARN("eventfd()");
+        pthread_mutex_unlock(&listmutex);
+        return NULL;
     }
+    threadlist *node = MALLOC(threadlist, 1); // linked into list only when thread is started
+    ti = &node->ti;
     memcpy(&ti->handler, handler, sizeof(thread_handler));
     snprintf(ti->name, THREADNAMEMAXLEN+1, "%s", name);
     ti->ID = ID;
@@ -210,42 +592,80 @@ threadinfo *registerThread(char *name, int ID, thread_handler *handler){
     pthread_mutex_init(&ti->commands.mutex, NULL);
     memset(&ti->answers, 0, sizeof(ti->answers));
     pthread_mutex_init(&ti->answers.mutex, NULL);
-    if(pthread_create(&ti->thread, NULL, handler->handler, (void*)ti)){
+    ti->evfd = evfd;
+    ti->commands.evfd = &ti->evfd;
+    ti->answers.evfd = &ti->evfd;
+    if(reactorevfd > -1){ // wake reactor to process new instance (and know its timer)
+        ti->commands.owner = ti;
+        ti->answers.owner = ti;
+        readypush(ti);
+        uint64_t one = 1;
+        if(sizeof(one) != write(reactorevfd, &one, sizeof(one))) WARN("write(eventfd)");
+    }
+    ti->nexttimer = dtime() + ROLE_TIMER_PERIOD;
+    if(handler->init) handler->init(ti);
+    if(reactorevfd < 0 && pthread_create(&ti->thread, NULL, roleThread, (void*)ti)){
         WARN("pthread_create()");
+        pthread_mutex_unlock(&listmutex);
+        close(evfd);
+        pthread_mutex_destroy(&ti->commands.mutex);
+        pthread_mutex_destroy(&ti->answers.mutex);
+        FREE(ti->roledata);
+        FREE(node);
         return NULL;
     }
+    if(!thelist) thelist = node; // the first element
+    else getlast()->next = node;
+    // publish (threads with ID out of CAN IDs range don't receive CAN messages, e.g. emulation)
+    if(ID < CANIDS_MAX) __atomic_store_n(&idtable[ID], ti, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&listmutex);
     return ti;
 }
 
 /**
- * @brief killThread - kill thread by its descriptor
+ * @brief unlinkThread - remove thread from list and ID table; listmutex should be locked
  * @param lptr - pointer to thread descriptor
- * @param prev - pointer to previous thread in list or NULL (to found it here)
- * @return 0 if all OK
+ * @param prev - pointer to previous thread in list or NULL if `lptr` is the first
+ * After this thread don't receive new messages, but it could be processed now
  */
-int killThread(threadlist *lptr, threadlist *prev){
-    if(!lptr) return 1;
-    if(!prev){
-        threadlist *t = thelist;
-        for(; t; t = t->next){
-            if(t == lptr) break;
-            prev = lptr;
-        }
+static void unlinkThread(threadlist *lptr, threadlist *prev){
+    DBG("Delete '%s'", lptr->ti.name);
+    if(lptr->ti.ID >= 0 && lptr->ti.ID < CANIDS_MAX && idtable[lptr->ti.ID] == &lptr->ti){
+        __atomic_store_n(&idtable[lptr->ti.ID], NULL, __ATOMIC_SEQ_CST); // unpublish
+        synchronize_dispatch();
+    }
+    if(lptr == thelist) thelist = lptr->next;
+    else if(prev) prev->next = lptr->next;
+    if(reactorevfd > -1) readyremove(&lptr->ti);
+}
+
+/**
+ * @brief freeThread - stop unlinked thread and free its data
+ * @param lptr - pointer to thread descriptor
+ * Thread is the only consumer of its queues, so it's stopped before destroying them: own thread
+ * is stopped cooperatively (by `stop` flag), reactor is waited while it processes instance.
+ * listmutex shouldn't be locked (callbacks running now can use it).
+ */
+static void freeThread(threadlist *lptr){
+    threadinfo *ti = &lptr->ti;
+    if(reactorevfd < 0){
+        uint64_t one = 1;
+        __atomic_store_n(&ti->stop, 1, __ATOMIC_RELEASE);
+        if(sizeof(one) != write(ti->evfd, &one, sizeof(one))) WARN("write(eventfd)");
+        pthread_join(ti->thread, NULL);
+        close(ti->evfd);
+    }else while(1){ // no one can pin instance out of list and ready queue, so wait for unpinning
+        pthread_mutex_lock(&listmutex);
+        readyremove(ti); // its callbacks could put it into queue again
+        int pins = __atomic_load_n(&ti->pins, __ATOMIC_ACQUIRE);
+        pthread_mutex_unlock(&listmutex);
+        if(!pins) break;
+        usleep(100);
     }
-    DBG("Delete '%s', prev: '%s'", lptr->ti.name, prev->ti.name);
-    threadlist *next = lptr->next;
-    if(lptr == thelist) thelist = next;
-    else if(prev) prev->next = next;
-    char *txt;
-    pthread_mutex_lock(&lptr->ti.commands.mutex);
-    while((txt = popmessage(&lptr->ti.commands.msg, NULL))) FREE(txt);
-    pthread_mutex_destroy(&lptr->ti.commands.mutex);
-    pthread_mutex_lock(&lptr->ti.answers.mutex);
-    while((txt = popmessage(&lptr->ti.answers.msg, NULL))) FREE(txt);
-    pthread_mutex_destroy(&lptr->ti.answers.mutex);
-    if(pthread_cancel(lptr->ti.thread)) WARN("Can't kill thread '%s'", lptr->ti.name);
+    pthread_mutex_destroy(&ti->commands.mutex);
+    pthread_mutex_destroy(&ti->answers.mutex);
+    FREE(ti->roledata);
     FREE(lptr);
-    return 0;
 }
 
 /**
@@ -255,21 +675,35 @@ int killThread(threadlist *lptr, threadlist *prev){
  */
 int killThreadByName(const char *name){
     if(!name || !thelist) return 1;
-    threadlist *lptr = thelist, *prev = NULL;
-    for(; lptr; lptr = lptr->next){
-        if(strcmp(lptr->ti.name, name)){
-            prev = lptr;
-            continue;
-        }
-        return killThread(lptr, prev);
+    pthread_mutex_lock(&listmutex);
+    threadlist *t = thelist, *prev = NULL;
+    for(; t; t = t->next){
+        if(strcmp(t->ti.name, name) == 0) break;
+        prev = t;
     }
-    return 2; // not found
+    if(t) unlinkThread(t, prev);
+    pthread_mutex_unlock(&listmutex);
+    if(!t) return 2; // not found
+    freeThread(t);
+    return 0;
+}
+
+/**
+ * @brief lockThreadList - deny registering and killing of threads (e.g. to walk list by `nextThread`)
+ */
+void lockThreadList(){
+    pthread_mutex_lock(&listmutex);
+}
+
+void unlockThreadList(){
+    pthread_mutex_unlock(&listmutex);
 }
 
 /**
  * @brief nextThread - get next thread in `thelist`
  * @param curr - pointer to previous thread or NULL for `thelist`
  * @return pointer to next thread in list (or NULL if absent)
+ * List should be locked by `lockThreadList` while walking
  */
 threadlist *nextThread(threadlist *curr){
     if(!curr) return thelist;
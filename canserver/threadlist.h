@@ -21,38 +21,95 @@
 #define THREADLIST_H__
 
 #include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "canopen.h"
 
 // max length (in symbols) of thread name (any zero-terminated string)
 #define THREADNAMEMAXLEN    (31)
+// amount of 11-bit CAN IDs
+#define CANIDS_MAX          (2048)
+
+// size of messages ring buffer (should be power of 2)
+#define MESGBUF_SZ          (32768)
+// max length of text message
+#define MESGTEXT_MAX        (1024)
+
+// types of records in messages FIFO
+typedef enum{
+    MESG_TEXT,          // zero-terminated string
+    MESG_CAN,           // CANmesg
+    MESG_SDODATA        // SDOdata
+} mesgtype;
 
-// messages FIFO
-typedef struct msglist_{
-    void *data;                     // message itself
-    size_t size;                    // message length in bytes
-    struct msglist_ *next, *last;   // other elements of list
-} msglist;
+/*
+ * Interthread messages FIFO: ring buffer of records (uint32_t size, uint32_t type, data aligned by 4 bytes)
+ * Consumer is only one thread and don't lock anything; producers are serialized by `mutex`.
+ * Zero-filled structure is empty FIFO ready to use.
+ */
+struct threadinfo_;
 
-// interthread messages; index 0 - MOSI, index 1 - MISO
 typedef struct{
-    msglist *msg;          // stringified text messages
-    pthread_mutex_t mutex;  // text changing mutex
+    uint8_t buf[MESGBUF_SZ];    // records
+    uint32_t head;              // read position (changed only by consumer)
+    uint32_t tail;              // write position (changed only by producers)
+    pthread_mutex_t mutex;      // producers' mutex
+    int *evfd;                  // eventfd to wake up consumer (or NULL)
+    uint32_t dropped;           // amount of messages dropped by overflow since last report
+    struct threadinfo_ *owner;  // role instance to put into reactor's ready queue (or NULL)
 } message;
 
-// name - handler pair for threads registering functions
+// max length of request tag (`@tag` before client's command, echoed on correlated answers)
+#define TAGMAXLEN           (15)
+// max amount of outstanding tagged requests of one thread
+#define REQTAGS_MAX         (64)
+// tag of request without answer is forgotten after this time (seconds)
+#define REQTAG_TMOUT        (10.)
+
+// tag of outstanding request (e.g. SDO: key is NodeID, index and subindex)
 typedef struct{
-    const char *name;               // handler name
-    void *(*handler)(void *);       // handler function
-    const char *helpmesg;           // help message
+    uint32_t key;                   // request key
+    uint32_t seq;                   // number of request (answers come in order of requests)
+    double t;                       // time of request (0 - slot is free)
+    char tag[TAGMAXLEN+1];          // tag (empty string - request without tag)
+} reqtag;
+
+// period of `timer` callback of thread handlers (seconds)
+#define ROLE_TIMER_PERIOD   (1.)
+
+/*
+ * Role of thread: name, callbacks and help. All callbacks are optional; they are called
+ * by the own thread of role instance or (in reactor mode) by the single reactor thread.
+ */
+typedef struct{
+    const char *name;                                           // handler name
+    void (*init)(struct threadinfo_ *ti);                       // called once when registered
+    void (*command)(struct threadinfo_ *ti, char *cmd);         // process command from client
+    void (*answer)(struct threadinfo_ *ti, const CANmesg *ans); // process message from CAN bus
+    void (*sdodata)(struct threadinfo_ *ti, const SDOdata *d);  // process data of segmented SDO upload
+    void (*timer)(struct threadinfo_ *ti);                      // called each ROLE_TIMER_PERIOD
+    const char *helpmesg;                                       // help message
 } thread_handler;
 
 // thread information
-typedef struct{
+typedef struct threadinfo_{
     char name[THREADNAMEMAXLEN+1];  // thread name
     int ID;                         // numeric ID (canopen ID)
     message commands;               // commands from clients (char *)
     message answers;                // answers from CANserver (CANmesg *)
-    pthread_t thread;               // thread descriptor
+    int evfd;                       // eventfd signaled when `commands` or `answers` got new data
+    pthread_t thread;               // thread descriptor (if not in reactor mode)
     thread_handler handler;         // handler name & function
+    void *roledata;                 // role-specific data (allocated by `init`, free'd when thread killed)
+    double nexttimer;               // time of next `timer` call (callbacks can decrease it)
+    char tag[TAGMAXLEN+1];          // tag of command processing now (empty if none)
+    reqtag reqtags[REQTAGS_MAX];    // tags of outstanding requests
+    uint32_t reqseq;                // number of the last request in `reqtags`
+    struct threadinfo_ *readynext;  // next instance in reactor's ready queue
+    int inready;                    // ==1 if instance is in reactor's ready queue
+    int pins;                       // >0 while reactor processes instance (it can't be freed)
+    int stop;                       // ==1 to stop own thread of instance
 } threadinfo;
 
 // list of threads member
@@ -65,10 +122,19 @@ threadinfo *findThreadByName(char *name);
 threadinfo *findThreadByID(int ID);
 threadinfo *registerThread(char *name, int ID, thread_handler *handler);
 threadlist *nextThread(threadlist *curr);
+void lockThreadList();
+void unlockThreadList();
 int killThreadByName(const char *name);
-char *mesgGetText(message *msg);
 char *mesgAddText(message *msg, char *txt);
-void *mesgGetObj(message *msg, size_t *size);
-void *mesgAddObj(message *msg, void *data, size_t size);
+void *mesgAddObj(message *msg, mesgtype type, void *data, size_t size);
+void *mesgAddObjs(message *msg, mesgtype type, void *data, size_t size, int n);
+size_t mesgGetBuf(message *msg, mesgtype *type, void *buf, size_t bufsz);
+char *mesgGetTextBuf(message *msg, char *buf, size_t bufsz);
+int mesgWait(int evfd, double tmout);
+int startReactor();
+int dispatchToThreads(int ID, mesgtype type, void *data, size_t size);
+char *gettag(char *str, char tag[TAGMAXLEN+1]);
+void tagRequest(threadinfo *ti, uint32_t key);
+int tagAnswer(threadinfo *ti, uint32_t key, char tag[TAGMAXLEN+1]);
 
 #endif // THREADLIST_H__
@@ -22,7 +22,9 @@
 #include <sys/select.h>
 #include <usefull_macros.h>
 
+#include "binframe.h"
 #include "canbus.h"
+#include "canline.h"
 
 #ifndef BUFLEN
 #define BUFLEN 80
@@ -43,7 +45,14 @@ This file should provide next functions:
 
 static sl_tty_t *dev = NULL;  // shoul be global to restore if die
 static int serialspeed = 115200; // speed to open serial device
+static int allowbinary = 0; // ==1 to try binary framing (new adapter firmware)
+static int binmode = 0; // ==1 if adapter works in binary framing mode
+static binframe_buf binbuf; // RX buffer of binary mode
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+// receive filters
+static canfilter filters[CANFILTERS_MAX];
+static int nfilters = 0; // ==0 - receive all
+static pthread_mutex_t fltmutex = PTHREAD_MUTEX_INITIALIZER;
 
 static char *read_string();
 
@@ -115,16 +124,127 @@ static int ttyWR(const char *buff, int len){
     return w;
 }
 
+/**
+ * @brief binWR - thread-safe writing of binary frame
+ * @param frame - frame to write
+ * @param len   - its length
+ * @return 0 if all OK
+ */
+static int binWR(const uint8_t *frame, int len){
+    if(len < 1) return 1;
+    pthread_mutex_lock(&mutex);
+    int w = sl_tty_write(dev->comfd, (const char*)frame, len);
+    pthread_mutex_unlock(&mutex);
+    return w;
+}
+
+/**
+ * @brief read_binframe - read next binary frame (with WAIT_TMOUT timeout)
+ * @param type (o)    - frame type
+ * @param payload (o) - buffer for payload (not less than BIN_MAXPAYLOAD)
+ * @return payload length, -1 if nothing read or -2 if tty disconnected
+ */
+static int read_binframe(uint8_t *type, uint8_t *payload){
+    double d0 = sl_dtime();
+    while(1){
+        int l = binframe_get(&binbuf, type, payload);
+        if(l > -1) return l;
+        if(sl_dtime() - d0 > WAIT_TMOUT) break;
+        l = read_ttyX(dev);
+        if(l < 0){
+            WARNX("tty disconnected");
+            return -2;
+        }
+        if(l == 0) continue;
+        binframe_add(&binbuf, dev->buf, l);
+        d0 = sl_dtime();
+    }
+    return -1;
+}
+
+/**
+ * @brief negotiate_binary - try to switch adapter into binary framing mode
+ * @return 1 if adapter works in binary mode, 0 if only ASCII protocol supported
+ */
+static int negotiate_binary(){
+    binmode = 0;
+    binbuf.len = 0;
+    if(!allowbinary) return 0;
+    canbus_clear();
+    if(sl_tty_write(dev->comfd, BINMODE_CMD "\n", sizeof(BINMODE_CMD))) return 0;
+    double t0 = sl_dtime();
+    while(sl_dtime() - t0 < BINMODE_TMOUT){
+        char *s = read_string(); // skip echo and other garbage
+        if(s && strncmp(s, BINMODE_ANS, sizeof(BINMODE_ANS) - 1) == 0){
+            binmode = 1;
+            break;
+        }
+    }
+    if(binmode){
+        DBG("CAN adapter works in binary mode");
+    }else{
+        WARNX("CAN adapter doesn't support binary mode, use ASCII");
+        canbus_clear();
+    }
+    return binmode;
+}
+
 void canbus_close(){
     if(dev) sl_tty_close(&dev);
+    binmode = 0;
 }
 
 void setserialspeed(int speed){
     serialspeed = speed;
 }
 
+/**
+ * @brief canbus_setfilters - set receive filters
+ * @param f - array of ID/mask pairs: message passes if (ID & mask) == (f.ID & mask)
+ * @param n - its length (0 - receive all)
+ * @return 0 if all OK
+ */
+int canbus_setfilters(const canfilter *f, int n){
+    if(n < 0 || (n && !f)) return 1;
+    if(n > CANFILTERS_MAX){
+        WARNX("Too many CAN filters (%d), receive all", n);
+        n = 0;
+    }
+    pthread_mutex_lock(&fltmutex);
+    if(n) memcpy(filters, f, n * sizeof(canfilter));
+    nfilters = n;
+    pthread_mutex_unlock(&fltmutex);
+    return 0;
+}
+
+// @return 1 if message with given ID passes filters
+static int canbus_accept(uint16_t ID){
+    int ret = 0;
+    pthread_mutex_lock(&fltmutex);
+    if(!nfilters) ret = 1;
+    else for(int i = 0; i < nfilters; ++i){
+        if((ID & filters[i].mask) == (filters[i].ID & filters[i].mask)){
+            ret = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fltmutex);
+    return ret;
+}
+
+/**
+ * @brief setbinarymode - allow or deny binary framing of adapter link
+ * @param allow - ==1 to try binary framing (adapter firmware should support it: old firmware
+ *      takes "binmode" for bitrate command "b")
+ * Should be called before `canbus_open`
+ */
+void setbinarymode(int allow){
+    allowbinary = allow;
+}
+
 void canbus_clear(){
     while(read_ttyX(dev));
+    binbuf.len = 0;
 }
 
 int canbus_open(const char *devname){
@@ -141,6 +261,7 @@ int canbus_open(const char *devname){
     if(!dev){
         return 1;
     }
+    negotiate_binary();
     return 0;
 }
 
@@ -153,6 +274,13 @@ int canbus_setspeed(int speed){
     }
     int len = snprintf(buff, BUFLEN, "b %d", speed);
     if(len < 1) return 2;
+    if(binmode){
+        uint8_t frame[BIN_FRAMESZ];
+        len = binframe_make(BINF_CMD, (uint8_t*)buff, len, frame);
+        int r = len ? binWR(frame, len) : 2;
+        canbus_clear();
+        return r;
+    }
     int r = ttyWR(buff, len);
     read_string(); // clear RX buf ('Reinit CAN bus with speed XXXXkbps')
     return r;
@@ -162,6 +290,10 @@ int canbus_write(CANmesg *mesg){
     FNAME();
     char buf[BUFLEN];
     if(!mesg || mesg->len > 8) return 1;
+    if(binmode){
+        uint8_t frame[BIN_FRAMESZ];
+        return binWR(frame, binframe_mkcan(mesg->ID, mesg->data, mesg->len, frame));
+    }
     int rem = BUFLEN, len = 0;
     int l = snprintf(buf, rem, "s %d", mesg->ID);
     rem -= l; len += l;
@@ -232,13 +364,19 @@ static char *read_string(){
     return NULL;
 }
 
-CANmesg *parseCANmesg(const char *str){
-    static CANmesg m;
-    int l = sscanf(str, "%d #0x%hx 0x%hhx 0x%hhx 0x%hhx 0x%hhx 0x%hhx 0x%hhx 0x%hhx 0x%hhx", &m.timemark, &m.ID,
-                   &m.data[0], &m.data[1], &m.data[2], &m.data[3], &m.data[4], &m.data[5], &m.data[6], &m.data[7]);
-    if(l < 2) return NULL;
-    m.len = l - 2;
-    return &m;
+/**
+ * @brief parseCANmesg - message parser
+ * @param str - string from terminal: time #0xID [0xdata]
+ * @param m (o) - parsed message
+ * @return 0 if all OK
+ * Reentrant: all data stored only in `m`
+ */
+int parseCANmesg(const char *str, CANmesg *m){
+    if(!str || !m) return 1;
+    const char *s = canline_hdr(str, &m->timemark, &m->ID);
+    if(!s) return 1;
+    m->len = canline_data(s, m->data);
+    return 0;
 }
 
 #ifdef EBUG
@@ -251,16 +389,55 @@ void showM(CANmesg *m){
 }
 #endif
 
+// canbus_read for binary mode
+static int canbus_readbin(CANmesg *mesg){
+    uint8_t payload[BIN_MAXPAYLOAD + 1], type;
+    CANmesg m;
+    double t0 = sl_dtime();
+    int ID = mesg->ID;
+    while(sl_dtime() - t0 < T_POLLING_TMOUT){
+        int l = read_binframe(&type, payload);
+        if(l == -2) return 2;
+        if(l < 0) continue;
+        if(type == BINF_CAN){
+            if(binframe_parsecan(payload, l, &m.timemark, &m.ID, m.data, &m.len)){
+                WARNX("Got wrong binary CAN frame");
+                continue;
+            }
+            if(!canbus_accept(m.ID)) continue;
+#ifdef EBUG
+            showM(&m);
+#endif
+            if(ID && m.ID == ID){
+                memcpy(mesg, &m, sizeof(CANmesg));
+                return 0;
+            }
+        }else if(type == BINF_CMD){
+            payload[l] = 0;
+            DBG("Adapter answer: %s", (char*)payload);
+        }
+    }
+    return 1;
+}
+
 int canbus_read(CANmesg *mesg){
     if(!mesg) return 1;
     pthread_mutex_lock(&mutex);
+    if(binmode){
+        int r = canbus_readbin(mesg);
+        pthread_mutex_unlock(&mutex);
+        return r;
+    }
     double t0 = sl_dtime();
     int ID = mesg->ID;
     char *ans;
-    CANmesg *m;
+    CANmesg M, *m = &M;
+    const char *data;
     while(sl_dtime() - t0 < T_POLLING_TMOUT){ // read answer
         if((ans = read_string())){ // parse new data
-            if((m = parseCANmesg(ans))){
+            if((data = canline_hdr(ans, &m->timemark, &m->ID))){
+                if(!canbus_accept(m->ID)) continue; // drop before data parsing
+                m->len = canline_data(data, m->data);
                 DBG("Got canbus message (dT=%g):", sl_dtime() - t0);
 #ifdef EBUG
                 showM(m);
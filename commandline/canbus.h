@@ -32,17 +32,28 @@ typedef struct{
     uint8_t len;        // data length
 } CANmesg;
 
+// max amount of receive filters
+#define CANFILTERS_MAX  (32)
+
+// receive filter: message passes if (ID & mask) == (filter.ID & filter.mask)
+typedef struct{
+    uint16_t ID;
+    uint16_t mask;
+} canfilter;
+
 // main (necessary) functions of canbus.c:
 void canbus_close();
 int canbus_open(const char *devname);
 int canbus_write(CANmesg *mesg);
 int canbus_read(CANmesg *mesg);
+int canbus_setfilters(const canfilter *f, int n);
 int canbus_setspeed(int speed);
 void canbus_clear();
 
 // auxiliary (not necessary) functions
 void setserialspeed(int speed);
+void setbinarymode(int allow);
 void showM(CANmesg *m);
-CANmesg *parseCANmesg(const char *str);
+int parseCANmesg(const char *str, CANmesg *m);
 
 #endif // CANBUS_H__
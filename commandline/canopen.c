@@ -374,6 +374,395 @@ int SDO_write(const SDO_dic_entry *e, uint8_t NID, int64_t data){
     return SDO_writeArr(e, NID, arr);
 }
 
+// amount of segments in block for block transfers (0 - don't use block transfers)
+static int blksize = 0;
+
+// send message to CAN bus, return 0 if all OK
+static int sendmesg(CANmesg *mesg){
+    int ans = 1;
+    for(int i = 0; i < NTRIES; ++i)
+        if(!(ans = canbus_write(mesg))) return 0;
+    return ans;
+}
+
+// wait for next SDO message from NID, return 0 if got
+static int getSDOmesg(uint8_t NID, CANmesg *mesg){
+    double t0 = sl_dtime();
+    while(sl_dtime() - t0 < SDO_ANS_TIMEOUT){
+        mesg->ID = TSDO_COBID | NID; // read only from given ID
+        if(canbus_read(mesg)) continue;
+        if(mesg->ID == (TSDO_COBID | NID) && mesg->len == 8) return 0;
+    }
+    return 1;
+}
+
+// wait for answer to initiate transfer request (with same index and subindex), return 0 if got
+static int getInitAns(uint16_t idx, uint8_t subidx, uint8_t NID, CANmesg *mesg){
+    double t0 = sl_dtime();
+    while(sl_dtime() - t0 < SDO_ANS_TIMEOUT){
+        if(getSDOmesg(NID, mesg)) break;
+        if(mesg->data[1] == (idx & 0xff) && mesg->data[2] == (idx >> 8) && mesg->data[3] == subidx) return 0;
+    }
+    WARNX("No answer from SDO 0x%X/0x%X", idx, subidx);
+    return 1;
+}
+
+// send abort of transfer to node
+static void abort_transfer(uint16_t idx, uint8_t subidx, uint8_t NID, uint32_t code){
+    CANmesg mesg = {.ID = RSDO_COBID + NID, .len = 8};
+    mesg.data[0] = SDO_CCS(CCS_ABORT_TRANSFER);
+    mesg.data[1] = idx & 0xff;
+    mesg.data[2] = (idx >> 8) & 0xff;
+    mesg.data[3] = subidx;
+    for(int i = 0; i < 4; ++i) mesg.data[4+i] = (code >> (8*i)) & 0xff;
+    sendmesg(&mesg);
+    const char *etxt = abortcode_text(code);
+    if(etxt) WARNX("Abort transfer of SDO 0x%X/0x%X: %s", idx, subidx, etxt);
+}
+
+// check if message is abort from node (and show its reason), return 1 if it is
+static int is_abort(CANmesg *mesg){
+    if(GET_CCS(mesg->data[0]) != CCS_ABORT_TRANSFER) return 0;
+    uint32_t ac = mku32(&mesg->data[4]);
+    const char *etxt = abortcode_text(ac);
+    WARNX("Got error for SDO 0x%X", mesg->data[1] | (mesg->data[2] << 8));
+    if(etxt) WARNX("Abort code 0x%X: %s", ac, etxt);
+    return 1;
+}
+
+/**
+ * @brief SDO_upload - read SDO of any size (by block, expedited or segmented transfer)
+ * @param idx    - SDO index
+ * @param subidx - SDO subindex
+ * @param NID    - target node ID
+ * @param buf (o)- buffer for data
+ * @param bufsz  - its size
+ * @return amount of bytes read or -1 if error
+ */
+int SDO_upload(uint16_t idx, uint8_t subidx, uint8_t NID, uint8_t *buf, int bufsz){
+    FNAME();
+    if(blksize){ // try block transfer first
+        int l = SDO_blockupload(idx, subidx, NID, buf, bufsz);
+        if(l != SDO_NOBLOCK) return l;
+    }
+    CANmesg mesg;
+    if(!buf || bufsz < 1 || ask2read(idx, subidx, NID) || getInitAns(idx, subidx, NID, &mesg)) return -1;
+    uint8_t spec = mesg.data[0];
+    if(is_abort(&mesg)) return -1;
+    if(GET_CCS(spec) != CCS_INIT_UPLOAD){
+        abort_transfer(idx, subidx, NID, SDO_ABORT_CCS);
+        return -1;
+    }
+    if(spec & SDO_E){ // expedited: all data in this message
+        int l = (spec & SDO_S) ? SDO_datalen(spec) : 4;
+        if(l > bufsz) l = bufsz;
+        memcpy(buf, &mesg.data[4], l);
+        return l;
+    }
+    int total = (spec & SDO_S) ? (int)mku32(&mesg.data[4]) : -1, pos = 0;
+    uint8_t toggle = 0;
+    do{ // segmented upload
+        CANmesg req = {.ID = RSDO_COBID + NID, .len = 8};
+        req.data[0] = SDO_CCS(CCS_SEG_UPLOAD) | (toggle ? SDO_T : 0);
+        if(sendmesg(&req) || getSDOmesg(NID, &mesg)){
+            abort_transfer(idx, subidx, NID, SDO_ABORT_TIMEOUT);
+            return -1;
+        }
+        spec = mesg.data[0];
+        if(is_abort(&mesg)) return -1;
+        if(GET_CCS(spec) != 0){ // not an upload segment
+            abort_transfer(idx, subidx, NID, SDO_ABORT_CCS);
+            return -1;
+        }
+        if(!!(spec & SDO_T) != toggle){
+            abort_transfer(idx, subidx, NID, SDO_ABORT_TOGGLE);
+            return -1;
+        }
+        int l = SDO_SEG_datalen(spec);
+        if(pos + l > bufsz){
+            abort_transfer(idx, subidx, NID, SDO_ABORT_NOMEM);
+            return -1;
+        }
+        memcpy(buf + pos, &mesg.data[1], l);
+        pos += l;
+        toggle = !toggle;
+    }while(!(spec & SDO_C));
+    if(total > -1 && total != pos) WARNX("SDO_upload(): got %d bytes instead of %d", pos, total);
+    return pos;
+}
+
+/**
+ * @brief SDO_download - write SDO of any size (by block, expedited or segmented transfer)
+ * @param idx    - SDO index
+ * @param subidx - SDO subindex
+ * @param NID    - target node ID
+ * @param data   - data to write
+ * @param len    - its length
+ * @return 0 if all OK
+ */
+int SDO_download(uint16_t idx, uint8_t subidx, uint8_t NID, const uint8_t *data, int len){
+    FNAME();
+    if(!data || len < 1) return 1;
+    if(blksize && len > 4){ // try block transfer first
+        int r = SDO_blockdownload(idx, subidx, NID, data, len);
+        if(r != SDO_NOBLOCK) return r;
+    }
+    CANmesg mesg = {.ID = RSDO_COBID + NID, .len = 8};
+    mesg.data[1] = idx & 0xff;
+    mesg.data[2] = (idx >> 8) & 0xff;
+    mesg.data[3] = subidx;
+    if(len < 5){ // expedited
+        mesg.data[0] = SDO_CCS(CCS_INIT_DOWNLOAD) | SDO_N(len) | SDO_E | SDO_S;
+        memcpy(&mesg.data[4], data, len);
+    }else{ // segmented, size indicated
+        mesg.data[0] = SDO_CCS(CCS_INIT_DOWNLOAD) | SDO_S;
+        for(int i = 0; i < 4; ++i) mesg.data[4+i] = (len >> (8*i)) & 0xff;
+    }
+    if(sendmesg(&mesg) || getInitAns(idx, subidx, NID, &mesg)) return 2;
+    if(is_abort(&mesg)) return 4;
+    if(GET_CCS(mesg.data[0]) != CCS_SEG_UPLOAD){ // initiate download response
+        WARNX("SDO_download(): got wrong answer");
+        return 6;
+    }
+    int pos = 0;
+    uint8_t toggle = 0;
+    while(pos < len){ // segmented download
+        int l = len - pos;
+        if(l > 7) l = 7;
+        CANmesg req = {.ID = RSDO_COBID + NID, .len = 8};
+        req.data[0] = SDO_CCS(CCS_SEG_DOWNLOAD) | (toggle ? SDO_T : 0) | SDO_SEG_N(l);
+        if(pos + l == len) req.data[0] |= SDO_C;
+        memcpy(&req.data[1], data + pos, l);
+        if(sendmesg(&req) || getSDOmesg(NID, &mesg)){
+            abort_transfer(idx, subidx, NID, SDO_ABORT_TIMEOUT);
+            return 3;
+        }
+        if(is_abort(&mesg)) return 4;
+        if(GET_CCS(mesg.data[0]) != CCS_INIT_DOWNLOAD){ // not a download segment response
+            abort_transfer(idx, subidx, NID, SDO_ABORT_CCS);
+            return 6;
+        }
+        if(!!(mesg.data[0] & SDO_T) != toggle){
+            abort_transfer(idx, subidx, NID, SDO_ABORT_TOGGLE);
+            return 5;
+        }
+        pos += l;
+        toggle = !toggle;
+    }
+    return 0;
+}
+
+/**
+ * @brief SDO_crc16 - CRC16-CCITT (x^16 + x^12 + x^5 + 1) of SDO block transfer
+ * @param data - data
+ * @param len  - its length
+ * @param crc  - initial value (0 for new calculation or previous result to continue it)
+ * @return calculated CRC
+ */
+uint16_t SDO_crc16(const uint8_t *data, int len, uint16_t crc){
+    for(int i = 0; i < len; ++i){
+        crc ^= (uint16_t)data[i] << 8;
+        for(int b = 0; b < 8; ++b)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
+
+/**
+ * @brief SDO_setblksize - set amount of segments in block for SDO_upload/SDO_download
+ * @param n - block size (1..127) or 0 to use only expedited and segmented transfers
+ */
+void SDO_setblksize(int n){
+    if(n < 0) n = 0;
+    else if(n > SDO_BLKSIZE_MAX) n = SDO_BLKSIZE_MAX;
+    blksize = n;
+}
+
+// check answer to initiate block transfer request
+// return 0 if it have given server command specifier, SDO_NOBLOCK if node don't support block mode or -1 if error
+static int chkBlkInit(uint16_t idx, uint8_t subidx, uint8_t NID, CANmesg *mesg, int scs){
+    if(GET_CCS(mesg->data[0]) == CCS_ABORT_TRANSFER && mku32(&mesg->data[4]) == SDO_ABORT_CCS){
+        DBG("Node %d don't support block transfer", NID);
+        return SDO_NOBLOCK;
+    }
+    if(is_abort(mesg)) return -1;
+    if(GET_CCS(mesg->data[0]) != scs){
+        abort_transfer(idx, subidx, NID, SDO_ABORT_CCS);
+        return SDO_NOBLOCK;
+    }
+    return 0;
+}
+
+/**
+ * @brief SDO_blockupload - read SDO by block transfer
+ * @param idx    - SDO index
+ * @param subidx - SDO subindex
+ * @param NID    - target node ID
+ * @param buf (o)- buffer for data
+ * @param bufsz  - its size
+ * @return amount of bytes read, -1 if error or SDO_NOBLOCK if node don't support block transfer
+ */
+int SDO_blockupload(uint16_t idx, uint8_t subidx, uint8_t NID, uint8_t *buf, int bufsz){
+    FNAME();
+    if(!buf || bufsz < 1) return -1;
+    uint8_t blk = blksize ? blksize : SDO_BLKSIZE_MAX;
+    CANmesg mesg, req = {.ID = RSDO_COBID + NID, .len = 8};
+    req.data[0] = SDO_CCS(CCS_BLOCK_UPLOAD) | SDO_BLK_CRC | SDO_BLK_INIT;
+    req.data[1] = idx & 0xff;
+    req.data[2] = (idx >> 8) & 0xff;
+    req.data[3] = subidx;
+    req.data[4] = blk;
+    req.data[5] = 0; // protocol switch threshold: never switch to segmented transfer
+    if(sendmesg(&req) || getInitAns(idx, subidx, NID, &mesg)) return -1;
+    int r = chkBlkInit(idx, subidx, NID, &mesg, CCS_BLOCK_DOWNLOAD); // initiate upload response
+    if(r) return r;
+    uint8_t crcsup = mesg.data[0] & SDO_BLK_CRC;
+    int total = (mesg.data[0] & SDO_BLK_S) ? (int)mku32(&mesg.data[4]) : -1;
+    if(total > bufsz){
+        abort_transfer(idx, subidx, NID, SDO_ABORT_NOMEM);
+        return -1;
+    }
+    memset(req.data, 0, 8);
+    req.data[0] = SDO_CCS(CCS_BLOCK_UPLOAD) | SDO_BLK_START;
+    if(sendmesg(&req)) return -1;
+    int pos = 0, last = 0;
+    while(!last){ // get sub-blocks
+        uint8_t seqno = 0; // last segment received in right sequence
+        while(1){
+            if(getSDOmesg(NID, &mesg)){ // server waits for acknowledge of received part
+                if(seqno) break;
+                abort_transfer(idx, subidx, NID, SDO_ABORT_TIMEOUT);
+                return -1;
+            }
+            // segment with seqno 0 is impossible, so 0x80 is abort
+            if(mesg.data[0] == SDO_CCS(CCS_ABORT_TRANSFER)){
+                is_abort(&mesg);
+                return -1;
+            }
+            uint8_t s = mesg.data[0] & ~SDO_BLK_LAST;
+            if(s == seqno + 1){ // copy only fitting data, overflow will be checked after end of transfer
+                int l = bufsz - pos;
+                if(l > 7) l = 7;
+                if(l > 0) memcpy(buf + pos, &mesg.data[1], l);
+                pos += 7;
+                seqno = s;
+                if(mesg.data[0] & SDO_BLK_LAST) last = 1;
+            }
+            if(s >= blk || (mesg.data[0] & SDO_BLK_LAST)) break; // end of sub-block
+        }
+        // acknowledge: server repeats all segments after `seqno` in next sub-block
+        req.data[0] = SDO_CCS(CCS_BLOCK_UPLOAD) | SDO_BLK_ACK;
+        req.data[1] = seqno;
+        req.data[2] = blk;
+        if(sendmesg(&req)) return -1;
+    }
+    // end of transfer: amount of empty bytes in last segment and CRC
+    if(getSDOmesg(NID, &mesg)){
+        abort_transfer(idx, subidx, NID, SDO_ABORT_TIMEOUT);
+        return -1;
+    }
+    if(is_abort(&mesg)) return -1;
+    if(GET_CCS(mesg.data[0]) != CCS_BLOCK_DOWNLOAD || SDO_BLK_SUB(mesg.data[0]) != SDO_BLK_END){
+        abort_transfer(idx, subidx, NID, SDO_ABORT_CCS);
+        return -1;
+    }
+    pos -= 7 - SDO_BLK_datalen(mesg.data[0]);
+    if(pos > bufsz){
+        abort_transfer(idx, subidx, NID, SDO_ABORT_NOMEM);
+        return -1;
+    }
+    if(crcsup && SDO_crc16(buf, pos, 0) != mku16(&mesg.data[1])){
+        abort_transfer(idx, subidx, NID, SDO_ABORT_CRC);
+        return -1;
+    }
+    memset(req.data, 0, 8);
+    req.data[0] = SDO_CCS(CCS_BLOCK_UPLOAD) | SDO_BLK_END;
+    if(sendmesg(&req)) return -1;
+    if(total > -1 && total != pos) WARNX("SDO_blockupload(): got %d bytes instead of %d", pos, total);
+    return pos;
+}
+
+/**
+ * @brief SDO_blockdownload - write SDO by block transfer
+ * @param idx    - SDO index
+ * @param subidx - SDO subindex
+ * @param NID    - target node ID
+ * @param data   - data to write
+ * @param len    - its length
+ * @return 0 if all OK, SDO_NOBLOCK if node don't support block transfer or error code
+ */
+int SDO_blockdownload(uint16_t idx, uint8_t subidx, uint8_t NID, const uint8_t *data, int len){
+    FNAME();
+    if(!data || len < 1) return 1;
+    CANmesg mesg, req = {.ID = RSDO_COBID + NID, .len = 8};
+    req.data[0] = SDO_CCS(CCS_BLOCK_DOWNLOAD) | SDO_BLK_CRC | SDO_BLK_S | SDO_BLK_INIT;
+    req.data[1] = idx & 0xff;
+    req.data[2] = (idx >> 8) & 0xff;
+    req.data[3] = subidx;
+    for(int i = 0; i < 4; ++i) req.data[4+i] = (len >> (8*i)) & 0xff;
+    if(sendmesg(&req) || getInitAns(idx, subidx, NID, &mesg)) return 2;
+    int r = chkBlkInit(idx, subidx, NID, &mesg, CCS_BLOCK_UPLOAD); // initiate download response
+    if(r) return (r == SDO_NOBLOCK) ? r : 4;
+    uint8_t crcsup = mesg.data[0] & SDO_BLK_CRC;
+    int blk = mesg.data[4], pos = 0;
+    while(pos < len){ // send sub-blocks
+        if(blk < 1 || blk > SDO_BLKSIZE_MAX){
+            abort_transfer(idx, subidx, NID, SDO_ABORT_BLKSIZE);
+            return 5;
+        }
+        int start = pos, seqno = 0;
+        while(seqno < blk && pos < len){
+            int l = len - pos;
+            if(l > 7) l = 7;
+            memset(req.data, 0, 8);
+            req.data[0] = ++seqno;
+            if(pos + l == len) req.data[0] |= SDO_BLK_LAST;
+            memcpy(&req.data[1], data + pos, l);
+            if(sendmesg(&req)){
+                abort_transfer(idx, subidx, NID, SDO_ABORT_TIMEOUT);
+                return 3;
+            }
+            pos += l;
+        }
+        if(getSDOmesg(NID, &mesg)){
+            abort_transfer(idx, subidx, NID, SDO_ABORT_TIMEOUT);
+            return 3;
+        }
+        if(is_abort(&mesg)) return 4;
+        if(GET_CCS(mesg.data[0]) != CCS_BLOCK_UPLOAD || SDO_BLK_SUB(mesg.data[0]) != SDO_BLK_ACK){
+            abort_transfer(idx, subidx, NID, SDO_ABORT_CCS);
+            return 6;
+        }
+        int ackseq = mesg.data[1];
+        if(ackseq > seqno){
+            abort_transfer(idx, subidx, NID, SDO_ABORT_SEQNO);
+            return 5;
+        }
+        if(ackseq < seqno) pos = start + 7*ackseq; // repeat lost segments
+        blk = mesg.data[2];
+    }
+    // end of transfer: amount of empty bytes in last segment and CRC
+    int n = len % 7;
+    if(!n) n = 7;
+    memset(req.data, 0, 8);
+    req.data[0] = SDO_CCS(CCS_BLOCK_DOWNLOAD) | SDO_BLK_N(n) | SDO_BLK_END;
+    if(crcsup){
+        uint16_t crc = SDO_crc16(data, len, 0);
+        req.data[1] = crc & 0xff;
+        req.data[2] = crc >> 8;
+    }
+    if(sendmesg(&req) || getSDOmesg(NID, &mesg)){
+        abort_transfer(idx, subidx, NID, SDO_ABORT_TIMEOUT);
+        return 3;
+    }
+    if(is_abort(&mesg)) return 4;
+    if(GET_CCS(mesg.data[0]) != CCS_BLOCK_UPLOAD || SDO_BLK_SUB(mesg.data[0]) != SDO_BLK_END){
+        abort_transfer(idx, subidx, NID, SDO_ABORT_CCS);
+        return 6;
+    }
+    return 0;
+}
+
 
 
 // read one byte of data
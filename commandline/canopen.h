@@ -69,6 +69,35 @@ typedef enum{
 // SDO e & s fields:
 #define SDO_E       (1<<1)
 #define SDO_S       (1<<0)
+// segment fields: toggle bit, no more segments bit and amount of data bytes
+#define SDO_T       (1<<4)
+#define SDO_C       (1<<0)
+#define SDO_SEG_N(n)        ((7-(n))<<1)
+#define SDO_SEG_datalen(f)  (7-(((f)>>1)&7))
+// block transfer fields: CRC supported, size indicated, subcommands, last segment flag
+#define SDO_BLK_CRC         (1<<2)
+#define SDO_BLK_S           (1<<1)
+#define SDO_BLK_INIT        (0)
+#define SDO_BLK_END         (1)
+#define SDO_BLK_ACK         (2)
+#define SDO_BLK_START       (3)
+#define SDO_BLK_SUB(f)      ((f)&3)
+#define SDO_BLK_LAST        (1<<7)
+#define SDO_BLK_N(n)        ((7-(n))<<2)
+#define SDO_BLK_datalen(f)  (7-(((f)>>2)&7))
+// max amount of segments in one block
+#define SDO_BLKSIZE_MAX     (127)
+// return value of block transfer functions if node doesn't support block mode
+#define SDO_NOBLOCK         (-2)
+
+// abort codes of transfers aborted by client
+#define SDO_ABORT_TOGGLE    (0x05030000)
+#define SDO_ABORT_TIMEOUT   (0x05040000)
+#define SDO_ABORT_CCS       (0x05040001)
+#define SDO_ABORT_BLKSIZE   (0x05040002)
+#define SDO_ABORT_SEQNO     (0x05040003)
+#define SDO_ABORT_CRC       (0x05040004)
+#define SDO_ABORT_NOMEM     (0x05040005)
 
 typedef struct{
     uint8_t NID;        // node ID in CANopen
@@ -87,6 +116,12 @@ int64_t SDO_read(const SDO_dic_entry *e, uint8_t NID);
 
 int SDO_writeArr(const SDO_dic_entry *e, uint8_t NID, const uint8_t *data);
 int SDO_write(const SDO_dic_entry *e, uint8_t NID, int64_t data);
+int SDO_upload(uint16_t idx, uint8_t subidx, uint8_t NID, uint8_t *buf, int bufsz);
+int SDO_download(uint16_t idx, uint8_t subidx, uint8_t NID, const uint8_t *data, int len);
+uint16_t SDO_crc16(const uint8_t *data, int len, uint16_t crc);
+void SDO_setblksize(int blksize);
+int SDO_blockupload(uint16_t idx, uint8_t subidx, uint8_t NID, uint8_t *buf, int bufsz);
+int SDO_blockdownload(uint16_t idx, uint8_t subidx, uint8_t NID, const uint8_t *data, int len);
 
 //int SDO_readByte(uint16_t idx, uint8_t subidx, uint8_t *data, uint8_t NID);
 #endif // CANOPEN_H__
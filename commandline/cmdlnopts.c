@@ -80,6 +80,10 @@ static sl_option_t cmdlnopts[] = {
     {"disablesw",NO_ARGS,   NULL,   'A',    arg_int,    APTR(&G.disableESW),_("disable end-switches")},
     {"wait",    NO_ARGS,    NULL,   'w',    arg_int,    APTR(&G.wait),      _("wait while motor is busy")},
     {"quick",   NO_ARGS,    NULL,   'q',    arg_int,    APTR(&G.quick),     _("directly send command without getting status")},
+    {"binary",  NO_ARGS,    NULL,   0,      arg_int,    APTR(&G.binary),    _("try binary framing of USB-CAN adapter link (for new adapter firmware)")},
+    {"blksize", NEED_ARG,   NULL,   'b',    arg_int,    APTR(&G.blksize),   _("use SDO block transfer with given block size (1..127)")},
+    {"upload",  NEED_ARG,   NULL,   0,      arg_string, APTR(&G.upload),    _("read SDO into file (arg: \"index,subindex,file\")")},
+    {"download",NEED_ARG,   NULL,   0,      arg_string, APTR(&G.download),  _("write file into SDO (arg: \"index,subindex,file\")")},
     {"verbose", NO_ARGS,    NULL,   'v',    arg_none,   APTR(&G.verblevel), _("verbosity level for logging (each -v increases level)")},
    end_option
 };
@@ -54,6 +54,10 @@ typedef struct{
     int disableESW;         // --//-- disable
     int wait;               // wait while device is busy
     int quick;              // directly send command without getting status
+    int binary;             // try binary framing of USB-CAN adapter link
+    int blksize;            // amount of segments in block of SDO block transfer (0 - don't use)
+    char *upload;           // "index,subindex,file" - read SDO into file
+    char *download;         // "index,subindex,file" - write file into SDO
 } glob_pars;
 
 
@@ -108,6 +108,10 @@ int parse_data_file(const char *fname, uint8_t nid){
                 WARNX("SDO 0x%04X/0x%02X isn't in dictionary", idx, sidx);
                 continue;
             }
+            if(entry->datasize == 0){
+                WARNX("SDO 0x%04X/0x%02X is a string, it can't be set by number", idx, sidx);
+                continue;
+            }
             if(data<0 && !entry->issigned){
                 WARNX("SDO 0x%04X/0x%02X is only positive", idx, sidx);
                 continue;
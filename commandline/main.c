@@ -18,6 +18,7 @@
 
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -127,11 +128,101 @@ static inline void gpioval(int64_t es){
     }
 }
 
+// read string SDO (datasize 0 in dictionary) into `buf` of size `bufsz`, return NULL if failed
+static char *readSDOstring(const SDO_dic_entry *entry, char *buf, int bufsz){
+    int l = SDO_upload(entry->index, entry->subindex, GP->NodeID, (uint8_t*)buf, bufsz - 1);
+    if(l < 0) return NULL;
+    buf[l] = 0;
+    return buf;
+}
+
+// max size of SDO data for --upload/--download
+#define BULKDATA_MAX    (65536)
+static uint8_t bulkdata[BULKDATA_MAX];
+
+// parse argument "index,subindex,file" of --upload/--download, return filename or NULL if error
+static char *bulkarg(char *arg, uint16_t *idx, uint8_t *subidx){
+    char *eptr;
+    long i = strtol(arg, &eptr, 0);
+    if(eptr == arg || *eptr != ',' || i < 0 || i > 0xffff) return NULL;
+    arg = eptr + 1;
+    long s = strtol(arg, &eptr, 0);
+    if(eptr == arg || *eptr != ',' || s < 0 || s > 0xff || !eptr[1]) return NULL;
+    *idx = (uint16_t)i;
+    *subidx = (uint8_t)s;
+    return eptr + 1;
+}
+
+// read SDO into file, return 0 if all OK
+static int uploadSDO(char *arg){
+    uint16_t idx;
+    uint8_t subidx;
+    char *fname = bulkarg(arg, &idx, &subidx);
+    if(!fname){
+        WARNX("Wrong argument \"%s\", need \"index,subindex,file\"", arg);
+        return 1;
+    }
+    double t0 = sl_dtime();
+    int l = SDO_upload(idx, subidx, GP->NodeID, bulkdata, BULKDATA_MAX);
+    if(l < 0){
+        WARNX("Can't read SDO 0x%04X/%d", idx, subidx);
+        return 1;
+    }
+    t0 = sl_dtime() - t0;
+    FILE *f = fopen(fname, "w");
+    if(!f){
+        WARN("Can't open %s", fname);
+        return 1;
+    }
+    int r = (fwrite(bulkdata, 1, l, f) != (size_t)l);
+    fclose(f);
+    if(r) WARN("Can't write %s", fname);
+    else message(1, "Read %d bytes of SDO 0x%04X/%d into %s (%.0f bytes/s)", l, idx, subidx, fname, l / t0);
+    return r;
+}
+
+// write file into SDO, return 0 if all OK
+static int downloadSDO(char *arg){
+    uint16_t idx;
+    uint8_t subidx;
+    char *fname = bulkarg(arg, &idx, &subidx);
+    if(!fname){
+        WARNX("Wrong argument \"%s\", need \"index,subindex,file\"", arg);
+        return 1;
+    }
+    FILE *f = fopen(fname, "r");
+    if(!f){
+        WARN("Can't open %s", fname);
+        return 1;
+    }
+    int l = (int)fread(bulkdata, 1, BULKDATA_MAX, f);
+    int toobig = (fgetc(f) != EOF);
+    fclose(f);
+    if(toobig || l < 1){
+        WARNX("File %s is empty or larger than %d bytes", fname, BULKDATA_MAX);
+        return 1;
+    }
+    double t0 = sl_dtime();
+    if(SDO_download(idx, subidx, GP->NodeID, bulkdata, l)){
+        WARNX("Can't write SDO 0x%04X/%d", idx, subidx);
+        return 1;
+    }
+    message(1, "Wrote %d bytes of %s into SDO 0x%04X/%d (%.0f bytes/s)", l, fname, idx, subidx, l / (sl_dtime() - t0));
+    return 0;
+}
+
 // show values of all parameters from dicentries.in
 static inline void showAllPars(){
     green("\nParameters' values:\n");
     for(int i = 0; i < DEsz; ++i){
         const SDO_dic_entry *entry = allrecords[i];
+        if(entry->datasize == 0){ // string
+            char str[256];
+            if(!readSDOstring(entry, str, 256)) WARNX("Can't read value of SDO 0x%04X/%d (%s)",
+                  entry->index, entry->subindex, entry->name);
+            else printf("# %s\n0x%04X, %d, \"%s\"\n", entry->name, entry->index, entry->subindex, str);
+            continue;
+        }
         int64_t val = SDO_read(entry, GP->NodeID);
         if(val == INT64_MIN){
             WARNX("Can't read value of SDO 0x%04X/%d (%s)",
@@ -196,6 +287,8 @@ int main(int argc, char *argv[]){
             ERRX("Set non-zero MAXSPEED");
     }
     if(GP->enableESW && GP->disableESW) ERRX("Enable & disable ESW can't meet together");
+    if(GP->blksize < 0 || GP->blksize > SDO_BLKSIZE_MAX) ERRX("Block size should be from 1 to %d", SDO_BLKSIZE_MAX);
+    SDO_setblksize(GP->blksize);
 
     sl_check4running(NULL, GP->pidfile);
     signal(SIGTERM, signals); // kill (-15) - quit
@@ -212,12 +305,16 @@ int main(int argc, char *argv[]){
         LOGMSG("Try to open CAN bus device %s", GP->device);
     }
     setserialspeed(GP->serialspeed);
+    setbinarymode(GP->binary);
     if(canbus_open(GP->device)){
         LogAndErr("Can't open %s @ speed %d. Exit.", GP->device, GP->serialspeed);
     }
     if(canbus_setspeed(GP->canspeed)){
         LogAndErr("Can't set CAN speed %d. Exit.", GP->canspeed);
     }
+    // we need only answers of our node
+    canfilter filter = {.ID = TSDO_COBID | GP->NodeID, .mask = 0x7ff};
+    canbus_setfilters(&filter, 1);
 
     // print current position and state
     int64_t i64;
@@ -278,6 +375,11 @@ int main(int argc, char *argv[]){
         i64 = SDO_read(&MICROSTEPS, ID);
         if(i64 == INT64_MIN) LogAndWarn("Can't get microstepping value");
         else message(2, "MICROSTEPS=%u", i64);
+        // device identity
+        char str[256];
+        if(readSDOstring(&DEVNAME, str, 256)) message(2, "DEVNAME=%s", str);
+        if(readSDOstring(&HWVERSION, str, 256)) message(2, "HWVERSION=%s", str);
+        if(readSDOstring(&SWVERSION, str, 256)) message(2, "SWVERSION=%s", str);
     }
     i64 = SDO_read(&ENCRESOL, ID);
     if(i64 == INT64_MIN){ /* LogAndWarn("Can't get encoder resolution value"); */}
@@ -319,6 +421,9 @@ int main(int argc, char *argv[]){
             ++p;
         }
     }
+    // bulk transfers of SDO data
+    if(GP->download) downloadSDO(GP->download);
+    if(GP->upload) uploadSDO(GP->upload);
     if(GP->absmove != INT_MIN){
         if(devstat == BUSY_STATE) ERRX("Can't move in BUSY state");
         SDO_write(&ENABLE, ID, 1);
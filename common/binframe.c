@@ -0,0 +1,148 @@
+/*
+ * This file is part of the stepper project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// binary framing of USB-CAN adapter link, common for canserver and commandline tool
+
+#include <string.h>
+#include <usefull_macros.h>
+
+#include "binframe.h"
+
+static uint8_t binchksum(const uint8_t *data, int len){
+    uint8_t s = 0;
+    for(int i = 0; i < len; ++i) s ^= data[i];
+    return s;
+}
+
+/**
+ * @brief binframe_make - make binary frame
+ * @param type    - frame type
+ * @param payload - frame data
+ * @param len     - its length
+ * @param frame (o) - frame (not less than BIN_FRAMESZ bytes)
+ * @return frame length or 0 if error
+ */
+int binframe_make(uint8_t type, const uint8_t *payload, int len, uint8_t *frame){
+    if(len < 0 || len > BIN_MAXPAYLOAD) return 0;
+    frame[0] = BIN_SYNC;
+    frame[1] = type;
+    frame[2] = (uint8_t)len;
+    memcpy(&frame[BIN_HDRSZ], payload, len);
+    frame[BIN_HDRSZ + len] = binchksum(&frame[1], len + 2);
+    return BIN_HDRSZ + len + 1;
+}
+
+/**
+ * @brief binframe_mkcan - make BINF_CAN frame to send
+ * @param ID    - CAN ID
+ * @param data  - message data
+ * @param len   - its length (0..8)
+ * @param frame (o) - frame (not less than BIN_FRAMESZ bytes)
+ * @return frame length or 0 if error
+ */
+int binframe_mkcan(uint16_t ID, const uint8_t *data, uint8_t len, uint8_t *frame){
+    if(len > 8) return 0;
+    uint8_t payload[10];
+    payload[0] = ID & 0xff;
+    payload[1] = (ID >> 8) & 0xff;
+    memcpy(&payload[2], data, len);
+    return binframe_make(BINF_CAN, payload, len + 2, frame);
+}
+
+// remove first `n` bytes from buffer
+static void binbuf_drop(binframe_buf *b, size_t n){
+    if(n >= b->len){
+        b->len = 0;
+        return;
+    }
+    memmove(b->buf, b->buf + n, b->len - n);
+    b->len -= n;
+}
+
+/**
+ * @brief binframe_add - add data read from adapter to buffer
+ * @param b    - buffer
+ * @param data - data read
+ * @param l    - its length
+ * @return 0 if all OK, 1 if buffer overflowed (old data dropped)
+ */
+int binframe_add(binframe_buf *b, const void *data, size_t l){
+    int ret = 0;
+    if(l > sizeof(b->buf) - b->len){ // buffer overflow
+        WARNX("binframe_add(): buffer overflow");
+        b->len = 0;
+        ret = 1;
+        if(l > sizeof(b->buf)) return 1;
+    }
+    memcpy(b->buf + b->len, data, l);
+    b->len += l;
+    return ret;
+}
+
+/**
+ * @brief binframe_get - extract next binary frame from buffer
+ * @param b           - buffer
+ * @param type (o)    - frame type
+ * @param payload (o) - buffer for payload (not less than BIN_MAXPAYLOAD)
+ * @return payload length or -1 if there's no full frame
+ */
+int binframe_get(binframe_buf *b, uint8_t *type, uint8_t *payload){
+    while(1){
+        // skip garbage before SYNC
+        size_t i = 0;
+        while(i < b->len && b->buf[i] != BIN_SYNC) ++i;
+        binbuf_drop(b, i);
+        if(b->len < BIN_HDRSZ) return -1;
+        uint8_t len = b->buf[2];
+        size_t flen = BIN_HDRSZ + len + 1;
+        if(len > BIN_MAXPAYLOAD){ // wrong SYNC - try next
+            binbuf_drop(b, 1);
+            continue;
+        }
+        if(b->len < flen) return -1;
+        if(binchksum(&b->buf[1], len + 2) != b->buf[flen - 1]){
+            WARNX("binframe_get(): bad checksum");
+            binbuf_drop(b, 1);
+            continue;
+        }
+        *type = b->buf[1];
+        memcpy(payload, &b->buf[BIN_HDRSZ], len);
+        binbuf_drop(b, flen);
+        return len;
+    }
+}
+
+/**
+ * @brief binframe_parsecan - parse payload of BINF_CAN frame: timemark[4] ID[2] data[0..8]
+ * @param payload      - payload
+ * @param len          - payload length
+ * @param timemark (o) - adapter's time mark
+ * @param ID (o)       - CAN ID
+ * @param data (o)     - message data (not less than 8 bytes)
+ * @param dlen (o)     - its length
+ * @return 0 if all OK
+ */
+int binframe_parsecan(const uint8_t *payload, int len, uint32_t *timemark, uint16_t *ID, uint8_t *data, uint8_t *dlen){
+    if(len < 6 || len > 14) return 1;
+    *timemark = (uint32_t)payload[0] | ((uint32_t)payload[1] << 8) |
+                ((uint32_t)payload[2] << 16) | ((uint32_t)payload[3] << 24);
+    *ID = ((uint16_t)payload[4] | ((uint16_t)payload[5] << 8)) & 0x7ff;
+    *dlen = (uint8_t)(len - 6);
+    memcpy(data, &payload[6], *dlen);
+    return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * This file is part of the stepper project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#ifndef BINFRAME_H__
+#define BINFRAME_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// timeout for binary mode negotiation answer
+#define BINMODE_TMOUT   (0.1)
+// ASCII command to switch adapter into binary framing and its answer
+#define BINMODE_CMD     "binmode"
+#define BINMODE_ANS     "BINARY"
+
+/*
+Binary framing of adapter link: SYNC TYPE LEN payload[LEN] CHK
+  SYNC - BIN_SYNC byte
+  TYPE - frame type (BINF_xx)
+  LEN  - payload length
+  CHK  - XOR of TYPE, LEN and all payload bytes
+*/
+#define BIN_SYNC        (0xA5)
+#define BIN_HDRSZ       (3)
+#define BIN_MAXPAYLOAD  (64)
+#define BIN_FRAMESZ     (BIN_HDRSZ + BIN_MAXPAYLOAD + 1)
+// CAN frame; host->adapter: ID[2] data[0..8]; adapter->host: timemark[4] ID[2] data[0..8] (all little-endian)
+#define BINF_CAN        ('c')
+// text command/answer (payload is ASCII string without trailing '\n')
+#define BINF_CMD        ('t')
+
+// RX buffer of binary mode
+typedef struct{
+    uint8_t buf[BIN_FRAMESZ * 4];
+    size_t len;                     // amount of data in `buf`
+} binframe_buf;
+
+int binframe_make(uint8_t type, const uint8_t *payload, int len, uint8_t *frame);
+int binframe_mkcan(uint16_t ID, const uint8_t *data, uint8_t len, uint8_t *frame);
+int binframe_add(binframe_buf *b, const void *data, size_t l);
+int binframe_get(binframe_buf *b, uint8_t *type, uint8_t *payload);
+int binframe_parsecan(const uint8_t *payload, int len, uint32_t *timemark, uint16_t *ID, uint8_t *data, uint8_t *dlen);
+
+#endif // BINFRAME_H__
@@ -0,0 +1,100 @@
+/*
+ * This file is part of the stepper project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// parser of ASCII lines of USB-CAN adapter, common for canserver and commandline tool
+// (reentrant and without libc conversions: it runs for each received frame)
+
+#include <stddef.h>
+
+#include "canline.h"
+
+// skip spaces and tabs
+static inline const char *skipspaces(const char *s){
+    while(*s == ' ' || *s == '\t') ++s;
+    return s;
+}
+
+/**
+ * @brief gethex - read hexadecimal number with mandatory "0x" prefix
+ * @param s (i)   - string
+ * @param val (o) - value read
+ * @param max     - maximal allowable value
+ * @return pointer to next symbol after number or NULL if error
+ */
+static const char *gethex(const char *s, uint32_t *val, uint32_t max){
+    if(s[0] != '0' || (s[1] | 0x20) != 'x') return NULL;
+    s += 2;
+    uint32_t v = 0;
+    int n = 0;
+    for(;; ++s, ++n){
+        uint8_t c = (uint8_t)*s, d;
+        if(c >= '0' && c <= '9') d = c - '0';
+        else{
+            c |= 0x20; // lowercase
+            if(c >= 'a' && c <= 'f') d = c - 'a' + 10;
+            else break;
+        }
+        v = (v << 4) | d;
+        if(v > max) return NULL;
+    }
+    if(!n) return NULL;
+    *val = v;
+    return s;
+}
+
+/**
+ * @brief canline_hdr - parse header (timemark and ID) of line with CAN frame
+ * @param str - string from adapter: time #0xID [0xdata]
+ * @param timemark (o) - time
+ * @param ID (o)       - frame identifier
+ * @return pointer to data part of `str` or NULL if it isn't CAN frame
+ */
+const char *canline_hdr(const char *str, uint32_t *timemark, uint16_t *ID){
+    const char *s = skipspaces(str);
+    uint32_t t = 0, v;
+    int n = 0;
+    while(*s >= '0' && *s <= '9'){
+        t = t * 10 + (uint32_t)(*s++ - '0');
+        ++n;
+    }
+    if(!n) return NULL;
+    s = skipspaces(s);
+    if(*s++ != '#') return NULL;
+    if(!(s = gethex(s, &v, 0x7ff))) return NULL;
+    *timemark = t;
+    *ID = (uint16_t)v;
+    return s;
+}
+
+/**
+ * @brief canline_data - parse data part of line (after `canline_hdr`)
+ * @param s - data part
+ * @param data (o) - data bytes
+ * @return amount of bytes (0..8)
+ */
+uint8_t canline_data(const char *s, uint8_t data[8]){
+    uint32_t v;
+    uint8_t n;
+    for(n = 0; n < 8; ++n){
+        const char *e = skipspaces(s);
+        if(!(e = gethex(e, &v, 0xff))) break;
+        data[n] = (uint8_t)v;
+        s = e;
+    }
+    return n;
+}
@@ -0,0 +1,34 @@
+/*
+ * This file is part of the stepper project.
+ * Copyright 2020 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#ifndef CANLINE_H__
+#define CANLINE_H__
+
+#include <stdint.h>
+
+/*
+ASCII lines of USB-CAN adapter with received frames: "timemark #0xID [0xNN ...]"
+  timemark - decimal time of MCU (ms)
+  ID       - 11-bit identifier
+  NN       - up to 8 data bytes
+*/
+
+const char *canline_hdr(const char *str, uint32_t *timemark, uint16_t *ID);
+uint8_t canline_data(const char *s, uint8_t data[8]);
+
+#endif // CANLINE_H__